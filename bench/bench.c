@@ -0,0 +1,1814 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+/* Host benchmark for the hardware-independent hot paths.
+ *
+ * Usage: pokebench [-q] [-b basestats03.bin] [file.sav ...]
+ *   -q  Quick mode: much shorter timing runs, for smoke testing the build
+ *   -b  Use a base stat dump from the SD card instead of synthetic stats
+ *
+ * Every kernel runs over a synthetic save first, then over each .sav given
+ * on the command line.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nds.h>
+
+#include "box_cache.h"
+#include "box_sort.h"
+#include "crc32.h"
+#include "host_stubs.h"
+#include "lz77.h"
+#include "pkm_dupes.h"
+#include "pkmx_format.h"
+#include "pokemon_strings.h"
+#include "savedata_gen3.h"
+#include "sd_boxes.h"
+#include "sd_file.h"
+#include "sd_groups.h"
+#include "sd_search.h"
+#include "util.h"
+
+#define FLASH_SIZE 0x20000
+#define SLOT_SIZE (SAVEDATA_NUM_SECTIONS * 0x1000)
+#define PC_NUM_PKM (14 * 30)
+// PKMX game ID of the cartridge boxes: Gen3, Emerald
+#define CART_GAME_ID (3 | 4 << 8)
+
+static uint64_t min_run_ns = 200000000;
+static int failures = 0;
+
+/* Benchmark harness */
+
+typedef void (*bench_fn)(void *ctx);
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * Runs fn repeatedly until it has taken at least min_run_ns, then reports the
+ * time per operation. Each call of fn counts as ops_per_call operations that
+ * each process bytes_per_op bytes.
+ */
+static void run_bench(const char *name, bench_fn fn, void *ctx,
+	uint32_t ops_per_call, uint32_t bytes_per_op) {
+
+	uint64_t calls = 1;
+	uint64_t elapsed;
+	double ns_per_op;
+
+	fn(ctx); // Warm up caches
+	for (;;) {
+		uint64_t start = now_ns();
+		for (uint64_t i = 0; i < calls; i++)
+			fn(ctx);
+		elapsed = now_ns() - start;
+		if (elapsed >= min_run_ns || calls >= (1ull << 40))
+			break;
+		calls *= 2;
+	}
+
+	ns_per_op = (double) elapsed / (double) (calls * ops_per_call);
+	if (bytes_per_op) {
+		printf("  %-34s %12.1f ns/op %10.2f MiB/s\n", name, ns_per_op,
+			bytes_per_op / ns_per_op * 1e9 / (1024.0 * 1024.0));
+	} else {
+		printf("  %-34s %12.1f ns/op\n", name, ns_per_op);
+	}
+}
+
+static void check(int condition, const char *what) {
+	if (!condition) {
+		printf("  FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+/* Synthetic data generation */
+
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t rng_next(void) {
+	// xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static const uint16_t section_sizes[SAVEDATA_NUM_SECTIONS] = {
+	0xf2c, 0xf80, 0xf80, 0xf80, 0xf08, 0xf80, 0xf80,
+	0xf80, 0xf80, 0xf80, 0xf80, 0xf80, 0xf80, 0x7d0
+};
+
+// Inverse of the substructure shuffle in decode_pkm_encrypted_data
+static void encode_pkm(uint8_t *dest, const pkm3_t *plain) {
+	static const uint8_t data_order[] = {
+		0xe4, 0xb4, 0xd8, 0x9c, 0x78, 0x6c,
+		0xe1, 0xb1, 0xd2, 0x93, 0x72, 0x63,
+		0xc9, 0x8d, 0xc6, 0x87, 0x4e, 0x4b,
+		0x39, 0x2d, 0x36, 0x27, 0x1e, 0x1b
+	};
+	uint8_t order = data_order[plain->personality % 24];
+	uint32_t xor = plain->personality ^ plain->trainerId;
+
+	memcpy(dest, plain->bytes, 32);
+	for (int i = 0; i < 4; i++) {
+		uint8_t *sub = dest + 32 + 12 * ((order >> (i * 2)) & 3);
+		memcpy(sub, plain->bytes + 32 + 12 * i, 12);
+		for (int j = 0; j < 12; j += 4)
+			SET32(sub, j) ^= xor;
+	}
+}
+
+static void make_synthetic_pkm(uint8_t *dest) {
+	pkm3_t pkm;
+	uint16_t checksum = 0;
+
+	memset(&pkm, 0, sizeof(pkm));
+	pkm.personality = rng_next();
+	pkm.trainerId = rng_next();
+	for (int i = 0; i < 10; i++)
+		pkm.nickname[i] = 0xBB + rng_next() % 26;
+	pkm.nickname[9] = 0xFF;
+	pkm.language = 0x202;
+	for (int i = 0; i < 7; i++)
+		pkm.trainerName[i] = 0xBB + rng_next() % 26;
+	pkm.species = 1 + rng_next() % 411;
+	pkm.held_item = rng_next() % 8 ? 0 : 1 + rng_next() % 376;
+	pkm.experience = rng_next() % 1000000;
+	pkm.friendship = 70;
+	for (int i = 0; i < 4; i++) {
+		pkm.moves[i] = 1 + rng_next() % 354;
+		pkm.move_pp[i] = 5 + rng_next() % 35;
+	}
+	for (int i = 0; i < 6; i++)
+		pkm.effort[i] = rng_next() % 86;
+	pkm.met_location = rng_next() % 200;
+	pkm.origins = (rng_next() % 100) | (3 << 7) | (4 << 11);
+	pkm.IVs = rng_next() & 0x3FFFFFFF;
+
+	for (int i = 32; i < 80; i += 2)
+		checksum += GET16(pkm.bytes, i);
+	pkm.checksum = checksum;
+	encode_pkm(dest, &pkm);
+}
+
+static void finish_section(uint8_t *section, uint16_t sectionId, uint32_t saveidx) {
+	uint32_t checksum = 0;
+	for (int i = 0; i < 0xFF0; i += 4)
+		checksum += GET32(section, i);
+	checksum = (checksum & 0xFFFF) + (checksum >> 16);
+	SET16(section, 0xFF4) = sectionId;
+	SET16(section, 0xFF6) = (uint16_t) checksum;
+	SET32(section, 0xFF8) = 0x08012025;
+	SET32(section, 0xFFC) = saveidx;
+}
+
+/**
+ * Fills one save slot with plausible data. The sections are rotated by the save
+ * index like the games do, and about 3 in 4 PC box slots hold a Pokemon.
+ */
+static void make_synthetic_slot(uint8_t *slot, uint32_t saveidx) {
+	uint8_t sections[SAVEDATA_NUM_SECTIONS][0x1000];
+	uint8_t *pc = malloc(SAVEDATA_NUM_SECTIONS * 0xf80);
+	uint8_t *pcPos;
+
+	memset(sections, 0, sizeof(sections));
+	for (int id = 0; id < SAVEDATA_NUM_SECTIONS; id++) {
+		if (id >= 5)
+			continue;
+		for (int i = 0; i < section_sizes[id]; i += 4)
+			SET32(sections[id], i) = rng_next();
+	}
+
+	// PC buffer: current box followed by 420 Pokemon, spread over sections 5-13
+	memset(pc, 0, SAVEDATA_NUM_SECTIONS * 0xf80);
+	SET32(pc, 0) = 0;
+	for (int i = 0; i < PC_NUM_PKM; i++) {
+		if (rng_next() % 4)
+			make_synthetic_pkm(pc + 4 + i * PKM3_SIZE);
+	}
+	pcPos = pc;
+	for (int id = 5; id < 13; id++, pcPos += 0xf80)
+		memcpy(sections[id], pcPos, 0xf80);
+	// Box names and wallpapers follow the last 0x744 bytes of Pokemon data
+	memcpy(sections[13], pcPos, 0x744);
+	memset(sections[13] + 0x744, 0xFF, 14 * 9);
+	free(pc);
+
+	// load_savedata refuses saves without the Pokedex (Emerald flag)
+	sections[2][0x3FC] |= 2;
+
+	for (int i = 0; i < SAVEDATA_NUM_SECTIONS; i++) {
+		uint16_t id = (i + saveidx) % SAVEDATA_NUM_SECTIONS;
+		finish_section(sections[id], id, saveidx);
+		memcpy(slot + i * 0x1000, sections[id], 0x1000);
+	}
+}
+
+static void make_synthetic_flash(uint8_t *flash) {
+	memset(flash, 0xFF, FLASH_SIZE);
+	make_synthetic_slot(flash, 41);
+	make_synthetic_slot(flash + SLOT_SIZE, 42);
+}
+
+/**
+ * Greedy LZ77 (type 0x10) compressor used to produce test input in the same
+ * format as the games' compressed graphics.
+ */
+static uint32_t lz77_compress_simple(uint8_t *out, const uint8_t *in, uint32_t len) {
+	uint32_t inPos = 0;
+	uint32_t outPos = 4;
+
+	SET32(out, 0) = len << 8 | 0x10;
+	while (inPos < len) {
+		uint32_t flagsPos = outPos++;
+		out[flagsPos] = 0;
+		for (int i = 0; i < 8 && inPos < len; i++) {
+			uint32_t bestLen = 0, bestDisp = 0;
+			uint32_t windowStart = inPos > 0x1000 ? inPos - 0x1000 : 0;
+			for (uint32_t cand = windowStart; cand + 1 < inPos; cand++) {
+				uint32_t matchLen = 0;
+				while (matchLen < 18 && inPos + matchLen < len &&
+					in[cand + matchLen] == in[inPos + matchLen])
+					matchLen++;
+				if (matchLen > bestLen) {
+					bestLen = matchLen;
+					bestDisp = inPos - cand - 1;
+				}
+			}
+			if (bestLen >= 3) {
+				out[flagsPos] |= 0x80 >> i;
+				out[outPos++] = (bestLen - 3) << 4 | bestDisp >> 8;
+				out[outPos++] = bestDisp & 0xFF;
+				inPos += bestLen;
+			} else {
+				out[outPos++] = in[inPos++];
+			}
+		}
+	}
+	while (outPos & 3)
+		out[outPos++] = 0;
+	return outPos;
+}
+
+// Wallpaper tiles with a repeating pattern and a tilemap of mostly sequential entries
+static void make_synthetic_wallpaper(uint8_t *tiles, uint16_t *tilemap) {
+	for (uint32_t i = 0; i < 0x1000; i++)
+		tiles[i] = (i / 32 % 4 == 0) ? rng_next() : 0x44 + (i / 4 % 8 == 0);
+	for (uint32_t i = 0; i < 0x2d0; i++)
+		tilemap[i] = (i % 30 < 24) ? (1 << 12 | (i / 30 * 8 + i % 8)) : 0;
+}
+
+// 24x24 4bpp item icon with a transparent border
+static void make_synthetic_item_icon(uint8_t *tiles) {
+	memset(tiles, 0, 24 * 24 / 2);
+	for (uint32_t i = 0; i < 24 * 24 / 2; i++) {
+		uint32_t row = i / 12, col = i % 12;
+		if (row >= 4 && row < 20 && col >= 2 && col < 10)
+			tiles[i] = 0x22 + (rng_next() % 3 == 0) * 0x10;
+	}
+}
+
+// 64x64 4bpp sprite with flat areas, outlines and some noise
+static void make_synthetic_sprite(uint8_t *tiles, uint32_t size) {
+	memset(tiles, 0, size);
+	for (uint32_t i = 0; i < 2048 && i < size; i++) {
+		uint32_t tile = i / 32;
+		uint32_t row = (i % 32) / 4;
+		if ((tile % 8) >= 2 && (tile % 8) < 6 && tile / 8 >= 1 && tile / 8 < 7)
+			tiles[i] = (row == 0 || row == 7) ? 0x11 : 0x33 + (rng_next() % 5 == 0);
+	}
+}
+
+/* Kernels */
+
+struct save_ctx {
+	const uint8_t *slot;
+	uint32_t sections[SAVEDATA_NUM_SECTIONS];
+	uint32_t saveidx;
+};
+
+static void bench_verify_slot(void *arg) {
+	struct save_ctx *ctx = arg;
+	verify_savedata_slot(ctx->slot, ctx->sections, &ctx->saveidx);
+}
+
+struct pkm_ctx {
+	const uint8_t *boxData;
+	uint32_t sink;
+};
+
+static void bench_decode_pc(void *arg) {
+	struct pkm_ctx *ctx = arg;
+	pkm3_t pkm;
+	for (int i = 0; i < PC_NUM_PKM; i++)
+		ctx->sink += decode_pkm_encrypted_data(&pkm, ctx->boxData + i * PKM3_SIZE);
+}
+
+static void bench_decode_batch_pc(void *arg) {
+	struct pkm_ctx *ctx = arg;
+	static pkm3_t pkms[PC_NUM_PKM];
+	decode_pkm_batch(pkms, NULL, ctx->boxData, PKM3_SIZE, PC_NUM_PKM);
+	ctx->sink += pkms[PC_NUM_PKM - 1].species;
+}
+
+static void bench_encode_pc(void *arg) {
+	struct pkm_ctx *ctx = arg;
+	static pkm3_t pkms[PC_NUM_PKM];
+	static uint8_t encoded[PC_NUM_PKM * PKM3_SIZE];
+	if (!ctx->sink)
+		decode_pkm_batch(pkms, NULL, ctx->boxData, PKM3_SIZE, PC_NUM_PKM);
+	encode_pkm_batch(encoded, PKM3_SIZE, pkms, PC_NUM_PKM);
+	ctx->sink += encoded[0] | 1;
+}
+
+static void bench_classify_pc(void *arg) {
+	struct pkm_ctx *ctx = arg;
+	for (int i = 0; i < PC_NUM_PKM; i++)
+		ctx->sink += pkm3_classify_slot(ctx->boxData + i * PKM3_SIZE);
+}
+
+static void bench_simplepkm_pc(void *arg) {
+	struct pkm_ctx *ctx = arg;
+	struct SimplePKM simple;
+	for (int i = 0; i < PC_NUM_PKM; i++) {
+		memset(&simple, 0, sizeof(simple));
+		simple.isOnCart = 1;
+		pkm3_to_simplepkm(&simple, ctx->boxData + i * PKM3_SIZE);
+		ctx->sink += simple.level;
+	}
+}
+
+struct hover_ctx {
+	const uint8_t *boxData;
+	uint8_t pkmx[PKMX_SIZE];
+	uint32_t sink;
+};
+
+/* Same path as the GUI: pkm_to_pkmx then a summary. The cursor goes over every
+ * slot of a box twice before moving to the next box.
+ */
+static void bench_hover(void *arg) {
+	struct hover_ctx *ctx = arg;
+	struct SimplePKM simple;
+	for (int i = 0; i < PC_NUM_PKM * 2; i++) {
+		int pkmIdx = (i / 60) * 30 + i % 30;
+		pkm_to_pkmx(ctx->pkmx, ctx->boxData + pkmIdx * PKM3_SIZE, CART_GAME_ID);
+		pkmx_to_simplepkm(&simple, ctx->pkmx, 1);
+		ctx->sink += simple.level;
+	}
+}
+
+struct write_ctx {
+	uint8_t *boxData;
+	uint32_t iteration;
+};
+
+static void bench_write_boxes(void *arg) {
+	struct write_ctx *ctx = arg;
+	uint8_t tmp[PKM3_SIZE];
+	uint8_t *a, *b;
+
+	// Swap two Pokemon per call so every write changes a little data
+	a = ctx->boxData + (ctx->iteration % PC_NUM_PKM) * PKM3_SIZE;
+	b = ctx->boxData + ((ctx->iteration * 7 + 1) % PC_NUM_PKM) * PKM3_SIZE;
+	memcpy(tmp, a, PKM3_SIZE);
+	memcpy(a, b, PKM3_SIZE);
+	memcpy(b, tmp, PKM3_SIZE);
+	write_boxes_savedata(ctx->boxData);
+	ctx->iteration++;
+}
+
+static void bench_load_savedata(void *arg) {
+	load_savedata(arg);
+}
+
+struct buffer_ctx {
+	uint8_t *data;
+	uint8_t *scratch;
+	uint32_t size;
+	uint32_t extractedSize; // For the lz77_extract kernels
+	uint32_t sink;
+};
+
+/* What crc32() did before slicing-by-8: one table lookup per byte */
+static uint32_t crc32_bytewise(const uint8_t *data, int n, uint32_t initial) {
+	static uint32_t table[256];
+	uint32_t crc = ~initial;
+
+	if (!table[1]) {
+		for (int i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int bit = 0; bit < 8; bit++)
+				c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+			table[i] = c;
+		}
+	}
+	for (int i = 0; i < n; i++)
+		crc = table[(uint8_t) crc ^ data[i]] ^ crc >> 8;
+	return ~crc;
+}
+
+/* Tries every start alignment and a spread of lengths, continuing a CRC
+ * across calls the way sd_boxes.c does.
+ */
+static int crc32_matches_bytewise(const uint8_t *data) {
+	for (int start = 0; start < 8; start++) {
+		for (int len = 0; len < 300; len += 1 + len / 8) {
+			uint32_t initial = crc32_bytewise(data + 4096, start + 3, 0);
+			if (crc32(data + start, len, initial) != crc32_bytewise(data + start, len, initial))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static void bench_crc32_bytewise(void *arg) {
+	struct buffer_ctx *ctx = arg;
+	ctx->sink += crc32_bytewise(ctx->data, ctx->size, 0);
+}
+
+static void bench_crc32(void *arg) {
+	struct buffer_ctx *ctx = arg;
+	ctx->sink += crc32(ctx->data, ctx->size, 0);
+}
+
+static void bench_lz77_size(void *arg) {
+	struct buffer_ctx *ctx = arg;
+	ctx->sink += lz77_compressed_size((const uint32_t*) ctx->data, ctx->size);
+}
+
+static void bench_lz77_truncate(void *arg) {
+	struct buffer_ctx *ctx = arg;
+	memcpy(ctx->scratch, ctx->data, ctx->size);
+	ctx->sink += lz77_truncate((uint32_t*) ctx->scratch, ctx->size, 2048);
+}
+
+static void bench_lz77_extract(void *arg) {
+	struct buffer_ctx *ctx = arg;
+	ctx->sink += lz77_extract_bounded(ctx->scratch, (const uint32_t*) ctx->data,
+		ctx->extractedSize, ctx->size);
+}
+
+/* What lz77_extract did before the in-tree decoder: the BIOS call, which
+ * the host build replaces with a plain C equivalent.
+ */
+static void bench_lz77_extract_bios(void *arg) {
+	struct buffer_ctx *ctx = arg;
+	swiDecompressLZSSWram(ctx->data, ctx->scratch);
+	ctx->sink += ctx->scratch[0];
+}
+
+/* Benchmark groups */
+
+static void run_save_benches(const char *label, const uint8_t *flash) {
+	struct save_ctx saveCtx;
+	struct pkm_ctx pkmCtx;
+	uint8_t *boxData, *encoded;
+	pkm3_t *pkms;
+	uint16_t checksums[PC_NUM_PKM];
+	int roundTrip, classifyMatches;
+	struct hover_ctx hoverCtx;
+	uint32_t sections[SAVEDATA_NUM_SECTIONS];
+	uint32_t saveidx[2];
+	int valid[2];
+	int newest;
+
+	printf("%s\n", label);
+	for (int slotIdx = 0; slotIdx < 2; slotIdx++) {
+		valid[slotIdx] = verify_savedata_slot(flash + slotIdx * SLOT_SIZE,
+			sections, &saveidx[slotIdx]);
+	}
+	check(valid[0] && valid[1], "both save slots verify");
+	if (!valid[0] && !valid[1])
+		return;
+
+	// Same comparison as load_savedata: UINT32_MAX sorts below any valid index
+	newest = !(valid[0] && saveidx[0] + 1 > saveidx[1] + 1);
+	if (!valid[newest])
+		newest = !newest;
+
+	saveCtx.slot = flash + newest * SLOT_SIZE;
+	run_bench("verify_savedata_slot", bench_verify_slot, &saveCtx, 1, SLOT_SIZE);
+
+	// Pull the PC boxes out of the newest slot the same way the GUI does
+	memcpy(savedata_buffer, flash + newest * SLOT_SIZE, SLOT_SIZE);
+	verify_savedata_slot(savedata_buffer, savedata_sections, &saveidx[0]);
+	boxData = malloc(PC_NUM_PKM * PKM3_SIZE);
+	load_boxes_savedata(boxData);
+
+	// Re-encoding every record with a valid checksum must give the same bytes
+	pkms = malloc(PC_NUM_PKM * sizeof(pkm3_t));
+	encoded = malloc(PC_NUM_PKM * PKM3_SIZE);
+	decode_pkm_batch(pkms, checksums, boxData, PKM3_SIZE, PC_NUM_PKM);
+	encode_pkm_batch(encoded, PKM3_SIZE, pkms, PC_NUM_PKM);
+	roundTrip = 1;
+	for (int i = 0; i < PC_NUM_PKM; i++) {
+		if (checksums[i] == pkms[i].checksum &&
+			memcmp(encoded + i * PKM3_SIZE, boxData + i * PKM3_SIZE, PKM3_SIZE) != 0)
+			roundTrip = 0;
+	}
+	check(roundTrip, "encode_pkm_batch inverts decode_pkm_batch");
+
+	// The fast empty test must agree with the species from a full decode
+	classifyMatches = 1;
+	for (int i = 0; i < PC_NUM_PKM; i++) {
+		pkm3_t pkm;
+		decode_pkm_encrypted_data(&pkm, boxData + i * PKM3_SIZE);
+		if ((pkm3_classify_slot(boxData + i * PKM3_SIZE) == PKM3_SLOT_EMPTY) !=
+			(pkm.species == 0))
+			classifyMatches = 0;
+	}
+	check(classifyMatches, "pkm3_classify_slot matches decoded species");
+	free(encoded);
+	free(pkms);
+
+	pkmCtx.boxData = boxData;
+	pkmCtx.sink = 0;
+	run_bench("decode_pkm_encrypted_data", bench_decode_pc, &pkmCtx,
+		PC_NUM_PKM, PKM3_SIZE);
+	run_bench("pkm3_classify_slot", bench_classify_pc, &pkmCtx,
+		PC_NUM_PKM, PKM3_SIZE);
+	run_bench("decode_pkm_batch (PC)", bench_decode_batch_pc, &pkmCtx,
+		PC_NUM_PKM, PKM3_SIZE);
+	pkmCtx.sink = 0;
+	run_bench("encode_pkm_batch (PC)", bench_encode_pc, &pkmCtx,
+		PC_NUM_PKM, PKM3_SIZE);
+	run_bench("pkm3_to_simplepkm", bench_simplepkm_pc, &pkmCtx,
+		PC_NUM_PKM, PKM3_SIZE);
+
+	hoverCtx.boxData = boxData;
+	hoverCtx.sink = 0;
+	run_bench("hover", bench_hover, &hoverCtx, PC_NUM_PKM * 2, PKM3_SIZE);
+	free(boxData);
+}
+
+static void run_lz77_extract_benches(const uint8_t *raw, uint32_t rawLen,
+	const char *label) {
+
+	struct buffer_ctx ctx;
+	uint8_t *compressed = malloc(rawLen * 9 / 8 + 16);
+	char name[64];
+
+	ctx.size = lz77_compress_simple(compressed, raw, rawLen);
+	ctx.data = compressed;
+	ctx.extractedSize = rawLen;
+	ctx.scratch = malloc(rawLen);
+	ctx.sink = 0;
+
+	snprintf(name, sizeof(name), "lz77_extract matches the BIOS decoder (%s)", label);
+	swiDecompressLZSSWram(compressed, ctx.scratch);
+	check(memcmp(ctx.scratch, raw, rawLen) == 0 &&
+		lz77_extract_bounded(ctx.scratch, (const uint32_t*) compressed, rawLen, ctx.size) ==
+		rawLen && memcmp(ctx.scratch, raw, rawLen) == 0, name);
+	snprintf(name, sizeof(name), "lz77_extract rejects short input (%s)", label);
+	check(lz77_extract_bounded(ctx.scratch, (const uint32_t*) compressed, rawLen,
+		ctx.size / 2) == 0, name);
+	{
+		/* Like a ROM read into a staging buffer that's too small for the
+		 * stream: the buffer is allocated at exactly its size, so reading
+		 * past it would show up under a memory checker.
+		 */
+		uint32_t stagedSize = ctx.size * 3 / 4;
+		uint8_t *staged = malloc(stagedSize);
+		memcpy(staged, compressed, stagedSize);
+		snprintf(name, sizeof(name), "lz77_extract stops at the staged input (%s)", label);
+		check(lz77_extract_bounded(ctx.scratch, (const uint32_t*) staged, rawLen,
+			stagedSize) == 0, name);
+		free(staged);
+	}
+	snprintf(name, sizeof(name), "lz77_extract rejects small output (%s)", label);
+	check(lz77_extract_bounded(ctx.scratch, (const uint32_t*) compressed, rawLen - 1,
+		ctx.size) == 0, name);
+
+	snprintf(name, sizeof(name), "BIOS decoder (%s)", label);
+	run_bench(name, bench_lz77_extract_bios, &ctx, 1, rawLen);
+	snprintf(name, sizeof(name), "lz77_extract (%s)", label);
+	run_bench(name, bench_lz77_extract, &ctx, 1, rawLen);
+
+	free(ctx.scratch);
+	free(compressed);
+}
+
+static void run_buffer_benches(void) {
+	struct buffer_ctx ctx;
+	uint8_t *sprite = malloc(8192);
+	uint8_t *compressed = malloc(8192 * 9 / 8 + 16);
+	uint32_t compressedLen;
+
+	printf("crc32\n");
+	ctx.size = 0x10000;
+	ctx.data = malloc(ctx.size);
+	for (uint32_t i = 0; i < ctx.size; i += 4)
+		SET32(ctx.data, i) = rng_next();
+	ctx.sink = 0;
+	check(crc32((const uint8_t*) "123456789", 9, 0) == 0xCBF43926, "crc32 check value");
+	check(crc32_matches_bytewise(ctx.data), "crc32 matches the byte-at-a-time loop");
+	run_bench("crc32, byte-at-a-time (64 KiB)", bench_crc32_bytewise, &ctx, 1, ctx.size);
+	run_bench("crc32 (64 KiB)", bench_crc32, &ctx, 1, ctx.size);
+	free(ctx.data);
+
+	/* Emerald stores some front sprites as 64x256 with only the top 64x64
+	 * used, which is the case lz77_truncate exists for.
+	 */
+	printf("lz77\n");
+	make_synthetic_sprite(sprite, 8192);
+	compressedLen = lz77_compress_simple(compressed, sprite, 8192);
+	ctx.data = compressed;
+	ctx.size = compressedLen;
+	ctx.scratch = malloc(8192);
+	ctx.sink = 0;
+	check(lz77_compressed_size((const uint32_t*) compressed, compressedLen + 64) ==
+		compressedLen, "lz77_compressed_size matches encoder output");
+	check(lz77_extract(ctx.scratch, (const uint32_t*) compressed, 8192) == 8192 &&
+		memcmp(ctx.scratch, sprite, 8192) == 0, "lz77_extract round trip");
+	{
+		// A back-reference to before the start of the output
+		const uint32_t badRef[2] = {4 << 8 | 0x10, 0x000500 | 0x80};
+		check(lz77_extract(ctx.scratch, badRef, 8192) == 0,
+			"lz77_extract rejects references before the output");
+	}
+	run_bench("lz77_compressed_size", bench_lz77_size, &ctx, 1, compressedLen);
+	run_bench("lz77_truncate (to 2048)", bench_lz77_truncate, &ctx, 1, compressedLen);
+	free(ctx.scratch);
+
+	run_lz77_extract_benches(sprite, 8192, "front sprite");
+	make_synthetic_wallpaper(sprite, (uint16_t*) (sprite + 0x1000));
+	run_lz77_extract_benches(sprite, 0x1000, "wallpaper tiles");
+	run_lz77_extract_benches(sprite + 0x1000, 0x5a0, "wallpaper tilemap");
+	make_synthetic_item_icon(sprite);
+	run_lz77_extract_benches(sprite, 24 * 24 / 2, "item icon");
+	// Runs with short periods give overlapping references at distances 2-6
+	for (uint32_t i = 0; i < 2048; i += 40) {
+		uint32_t period = 2 + rng_next() % 5;
+		for (uint32_t j = 0; j < 40 && i + j < 2048; j++)
+			sprite[i + j] = j < period ? rng_next() : sprite[i + j - period];
+	}
+	run_lz77_extract_benches(sprite, 2048, "short repeats");
+
+	free(sprite);
+	free(compressed);
+}
+
+static int dex_owned(uint16_t dexnum) {
+	return (GET_SAVEDATA_SECTION(0)[0x28 + (dexnum - 1) / 8] >> ((dexnum - 1) & 7)) & 1;
+}
+
+/* Checks that saving registers every species in the PC, and that a species
+ * only gets registered again after it is deposited.
+ */
+static void check_pokedex_registration(uint8_t *boxData) {
+	pkm3_t pkm;
+	uint16_t dexnum = 0;
+	uint8_t ownByte;
+	int allOwned = 1;
+
+	for (int i = 0; i < PC_NUM_PKM; i++) {
+		decode_pkm_encrypted_data(&pkm, boxData + i * PKM3_SIZE);
+		if (pkm.species && !PKM3_IS_EGG(pkm) && gen3_index_to_pokedex(pkm.species)) {
+			allOwned &= dex_owned(gen3_index_to_pokedex(pkm.species));
+			dexnum = gen3_index_to_pokedex(pkm.species);
+		}
+	}
+	check(dexnum && allOwned, "saving registers the PC species to the Pokedex");
+	if (!dexnum)
+		return;
+
+	// Forget the last species seen, it must stay unregistered until it is deposited again
+	ownByte = GET_SAVEDATA_SECTION(0)[0x28 + (dexnum - 1) / 8] & ~(1 << ((dexnum - 1) & 7));
+	savedata_write(0, 0x28 + (dexnum - 1) / 8, &ownByte, 1);
+	write_boxes_savedata(boxData);
+	check(!dex_owned(dexnum), "saving without deposits leaves the Pokedex alone");
+
+	// Withdraw and deposit every Pokemon of that species
+	for (int delta = -1; delta <= 1; delta += 2) {
+		for (int i = 0; i < PC_NUM_PKM; i++) {
+			decode_pkm_encrypted_data(&pkm, boxData + i * PKM3_SIZE);
+			if (pkm.species && !PKM3_IS_EGG(pkm) && gen3_index_to_pokedex(pkm.species) == dexnum)
+				pokedex_track_pkm(boxData + i * PKM3_SIZE, delta);
+		}
+	}
+	write_boxes_savedata(boxData);
+	check(dex_owned(dexnum), "depositing a species registers it on the next save");
+}
+
+/**
+ * Loads the save through load_savedata from a temporary copy, then writes the
+ * boxes back and checks that the written slot still verifies.
+ */
+static void run_write_benches(const uint8_t *flash) {
+	char filename[] = "/tmp/pokebench-XXXXXX";
+	struct write_ctx ctx;
+	uint8_t *written;
+	uint32_t sections[SAVEDATA_NUM_SECTIONS];
+	uint32_t saveidx;
+	int fd, targetSlot;
+	FILE *fp;
+
+	printf("save writing\n");
+	fd = mkstemp(filename);
+	fp = fd < 0 ? NULL : fdopen(fd, "w+b");
+	if (!fp) {
+		check(0, "create temporary save file");
+		return;
+	}
+	fwrite(flash, 1, FLASH_SIZE, fp);
+	fclose(fp);
+
+	check(load_savedata(filename), "load_savedata");
+	run_bench("load_savedata", bench_load_savedata, filename, 1, SLOT_SIZE);
+	targetSlot = !savedata_active_slot;
+
+	ctx.boxData = malloc(PC_NUM_PKM * PKM3_SIZE);
+	ctx.iteration = 0;
+	load_boxes_savedata(ctx.boxData);
+	run_bench("write_boxes_savedata", bench_write_boxes, &ctx, 1, PC_NUM_PKM * PKM3_SIZE);
+	check_pokedex_registration(ctx.boxData);
+
+	check(write_savedata(), "write_savedata");
+	written = malloc(FLASH_SIZE);
+	fp = fopen(filename, "rb");
+	check(fp && fread(written, 1, FLASH_SIZE, fp) == FLASH_SIZE, "read back save file");
+	if (fp)
+		fclose(fp);
+	check(verify_savedata_slot(written + targetSlot * SLOT_SIZE, sections, &saveidx),
+		"written slot verifies");
+
+	// Corrupt one byte of the newest slot, the loader should fall back to the other one
+	written[targetSlot * SLOT_SIZE + 0x100] ^= 1;
+	fp = fopen(filename, "wb");
+	if (fp) {
+		fwrite(written, 1, FLASH_SIZE, fp);
+		fclose(fp);
+	}
+	check(load_savedata(filename) && savedata_active_slot == !targetSlot,
+		"load_savedata falls back to the older slot");
+
+	free(written);
+	free(ctx.boxData);
+	remove(filename);
+}
+
+#define SD_NUM_BOXES 32
+#define SD_BOX_SIZE (30 * PKMX_SIZE)
+
+struct sd_ctx {
+	uint8_t *boxData;
+	uint32_t iteration;
+	uint32_t dirtyBoxes; // How many boxes each save changes
+};
+
+/* Changes, writes and commits ctx->dirtyBoxes boxes in the open group */
+static void bench_sd_save(void *arg) {
+	struct sd_ctx *ctx = arg;
+	sd_boxes_bytes_written = 0;
+	for (uint32_t i = 0; i < ctx->dirtyBoxes; i++) {
+		uint16_t boxIdx = (ctx->iteration + i) % SD_NUM_BOXES;
+		uint8_t *box = ctx->boxData + boxIdx * SD_BOX_SIZE;
+		box[ctx->iteration % SD_BOX_SIZE]++;
+		sd_boxes_write_box(box, boxIdx);
+	}
+	sd_boxes_commit(SD_NUM_BOXES);
+	ctx->iteration++;
+}
+
+/* Reopens the group and compares every box. The group is left open. */
+static int sd_boxes_match(const uint8_t *expected) {
+	uint8_t box[SD_BOX_SIZE];
+	uint16_t numBoxes = 0;
+	int ok = sd_boxes_open(0, &numBoxes) && numBoxes == SD_NUM_BOXES;
+	for (uint16_t boxIdx = 0; boxIdx < numBoxes && ok; boxIdx++) {
+		ok = sd_boxes_read_box(box, boxIdx) &&
+			memcmp(box, expected + boxIdx * SD_BOX_SIZE, SD_BOX_SIZE) == 0;
+	}
+	return ok;
+}
+
+static uint8_t* read_whole_file(const char *path, long *size_out) {
+	uint8_t *data = NULL;
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+	if (fseek(fp, 0, SEEK_END) == 0 && (*size_out = ftell(fp)) > 0) {
+		data = malloc(*size_out);
+		rewind(fp);
+		if (data && fread(data, 1, *size_out, fp) != (size_t) *size_out) {
+			free(data);
+			data = NULL;
+		}
+	}
+	fclose(fp);
+	return data;
+}
+
+static void flip_file_byte(const char *path, long offset) {
+	FILE *fp = fopen(path, "r+b");
+	int c;
+	if (!fp)
+		return;
+	fseek(fp, offset, SEEK_SET);
+	c = fgetc(fp);
+	fseek(fp, offset, SEEK_SET);
+	fputc(c ^ 0x01, fp);
+	fclose(fp);
+}
+
+/**
+ * Damages the record holding the given box contents, or the active directory
+ * if box is NULL. Returns 0 if the damage couldn't be done.
+ */
+static int damage_group_file(const uint8_t *box) {
+	const char *path = "pokebox/boxes/group000.bin";
+	long size, offset = -1;
+	uint8_t *data = read_whole_file(path, &size);
+
+	if (!data)
+		return 0;
+	if (box) {
+		for (long pos = 0; pos + SD_BOX_SIZE <= size && offset < 0; pos++) {
+			if (memcmp(data + pos, box, SD_BOX_SIZE) == 0)
+				offset = pos + 100;
+		}
+	} else {
+		// File header: activeSlot at 10, slot2Offset at 12, 48 bytes long
+		offset = (data[10] ? GET32(data, 12) : 48) + 20;
+	}
+	free(data);
+	if (offset < 0)
+		return 0;
+	flip_file_byte(path, offset);
+	return 1;
+}
+
+/* Writes a version 0 group file: both slots hold every box */
+static void write_sd_boxes_v0(const char *path, const uint8_t *boxData) {
+	uint8_t header[48] __attribute__((aligned(4))) = "PKMBBOXG";
+	uint8_t slotHeader[16] __attribute__((aligned(4))) = {0};
+	uint8_t boxmeta[32] = {0};
+	uint32_t slotSize = sizeof(slotHeader) + SD_NUM_BOXES * (sizeof(boxmeta) + SD_BOX_SIZE);
+	FILE *fp = fopen(path, "wb");
+
+	if (!fp)
+		return;
+	SET32(header, 12) = sizeof(header) + slotSize;
+	SET16(slotHeader, 14) = SD_NUM_BOXES;
+	fwrite(header, 1, sizeof(header), fp);
+	for (int slot = 0; slot < 2; slot++) {
+		fwrite(slotHeader, 1, sizeof(slotHeader), fp);
+		for (int i = 0; i < SD_NUM_BOXES; i++)
+			fwrite(boxmeta, 1, sizeof(boxmeta), fp);
+		fwrite(boxData, 1, SD_NUM_BOXES * SD_BOX_SIZE, fp);
+	}
+	fclose(fp);
+}
+
+#define CACHE_NUM_BOXES 255
+
+struct box_cache_ctx {
+	uint8_t *expected; // What every box should hold, CACHE_NUM_BOXES of them
+	uint32_t iteration;
+};
+
+/* Moves a byte between two random boxes the way store_holding does */
+static int box_cache_move(struct box_cache_ctx *ctx) {
+	uint16_t srcIdx = rng_next() % CACHE_NUM_BOXES;
+	uint16_t dstIdx = rng_next() % CACHE_NUM_BOXES;
+	uint32_t pos = rng_next() % SD_BOX_SIZE;
+	uint8_t *src = box_cache_get(srcIdx);
+	uint8_t *dst = box_cache_get(dstIdx);
+
+	// The first box has to stay resident while the second is fetched
+	if (!src || !dst || memcmp(src, ctx->expected + srcIdx * SD_BOX_SIZE, SD_BOX_SIZE) != 0)
+		return 0;
+	src[pos]++;
+	dst[pos]--;
+	ctx->expected[srcIdx * SD_BOX_SIZE + pos]++;
+	ctx->expected[dstIdx * SD_BOX_SIZE + pos]--;
+	box_cache_mark_dirty(srcIdx);
+	box_cache_mark_dirty(dstIdx);
+	return 1;
+}
+
+static int box_cache_match_boxes(const uint8_t *expected, uint16_t expectedBoxes) {
+	uint16_t numBoxes = 0;
+	int ok = box_cache_open(0, &numBoxes) && numBoxes == expectedBoxes;
+	for (uint16_t boxIdx = 0; boxIdx < numBoxes && ok; boxIdx++) {
+		const uint8_t *box = box_cache_get(boxIdx);
+		ok = box && memcmp(box, expected + boxIdx * SD_BOX_SIZE, SD_BOX_SIZE) == 0;
+	}
+	return ok;
+}
+
+static int box_cache_match(const uint8_t *expected) {
+	return box_cache_match_boxes(expected, CACHE_NUM_BOXES);
+}
+
+static void bench_box_cache_hit(void *arg) {
+	struct box_cache_ctx *ctx = arg;
+	box_cache_get(ctx->iteration++ & 1);
+}
+
+static void bench_box_cache_miss(void *arg) {
+	struct box_cache_ctx *ctx = arg;
+	box_cache_get(ctx->iteration++ % CACHE_NUM_BOXES);
+}
+
+/**
+ * Pages a 255-box group through the box cache, checking that evicted changes
+ * survive a save and disappear without one.
+ */
+static void run_box_cache_benches(void) {
+	struct box_cache_ctx ctx;
+	uint8_t *saved;
+	uint16_t numBoxes;
+	int ok = 1;
+
+	remove("pokebox/boxes/group000.bin");
+	ctx.expected = malloc(CACHE_NUM_BOXES * SD_BOX_SIZE);
+	saved = malloc(CACHE_NUM_BOXES * SD_BOX_SIZE);
+	for (int i = 0; i < CACHE_NUM_BOXES * SD_BOX_SIZE; i++)
+		ctx.expected[i] = rng_next();
+	check(sd_boxes_open(0, &numBoxes) && numBoxes == 32, "new groups start with 32 boxes");
+	for (uint16_t boxIdx = 0; boxIdx < CACHE_NUM_BOXES; boxIdx++)
+		sd_boxes_write_box(ctx.expected + boxIdx * SD_BOX_SIZE, boxIdx);
+	check(sd_boxes_commit(CACHE_NUM_BOXES), "commit a group of 255 boxes");
+	memcpy(saved, ctx.expected, CACHE_NUM_BOXES * SD_BOX_SIZE);
+	check(box_cache_match(ctx.expected), "255-box group loads through the cache");
+
+	for (int i = 0; i < 1000 && ok; i++)
+		ok = box_cache_move(&ctx);
+	check(ok, "cached boxes stay resident for a move");
+	check(box_cache_stats.writeBacks > 0, "evicted boxes get written back");
+	box_cache_close();
+	check(box_cache_match(saved), "closing without a save discards evicted changes");
+
+	memcpy(ctx.expected, saved, CACHE_NUM_BOXES * SD_BOX_SIZE);
+	for (int i = 0; i < 1000 && ok; i++)
+		ok = box_cache_move(&ctx);
+	check(ok && box_cache_save(), "save the box cache");
+	box_cache_close();
+	check(box_cache_match(ctx.expected), "saved changes load back");
+
+	ctx.iteration = 0;
+	run_bench("box_cache_get (hit)", bench_box_cache_hit, &ctx, 1, 0);
+	run_bench("box_cache_get (miss)", bench_box_cache_miss, &ctx, 1, 0);
+	printf("  %-34s %12lu bytes\n", "  resident box data",
+		(unsigned long) box_cache_resident_bytes());
+	printf("  %-34s %12lu bytes\n", "  whole group",
+		(unsigned long) CACHE_NUM_BOXES * SD_BOX_SIZE);
+	box_cache_close();
+
+	free(saved);
+	free(ctx.expected);
+}
+
+static void bench_sd_groups_rebuild(void *arg) {
+	*(int*) arg &= sd_groups_rebuild();
+}
+
+static void bench_sd_boxes_open(void *arg) {
+	uint16_t numBoxes;
+	*(int*) arg &= sd_boxes_open(0, &numBoxes);
+}
+
+/**
+ * Saves a second group next to group 0, which the box cache benchmark left
+ * with CACHE_NUM_BOXES boxes, and checks what the index says about both.
+ */
+static void run_sd_groups_benches(void) {
+	const struct sd_group_info *groups, *info;
+	uint8_t box[SD_BOX_SIZE];
+	uint16_t numGroups, numBoxes;
+	int ok = 1;
+
+	memset(box, 0, sizeof(box));
+	for (int i = 0; i < 7; i++)
+		box[i * PKMX_SIZE] = 3;
+	check(sd_boxes_open(5, &numBoxes) && sd_boxes_write_box(box, 0) &&
+		sd_boxes_write_box(box, 1) && sd_boxes_commit(2), "save a second group");
+	sd_boxes_close();
+
+	groups = sd_groups_list(&numGroups);
+	check(numGroups == 2 && groups[0].groupNumber == 0 && groups[1].groupNumber == 5,
+		"index lists both groups in order");
+	info = sd_groups_find(5);
+	check(info && info->numBoxes == 32 && info->numPokemon == 14 && info->saveCounter == 2,
+		"index counts boxes and Pokemon");
+	info = sd_groups_find(0);
+	check(info && info->numBoxes == CACHE_NUM_BOXES, "index follows the box cache saves");
+
+	remove("pokebox/boxes/groups.bin");
+	check(sd_groups_rebuild() && sd_groups_list(&numGroups) && numGroups == 2 &&
+		sd_groups_find(5)->numPokemon == 14, "missing index gets rebuilt");
+	run_bench("sd_groups_rebuild (2 groups)", bench_sd_groups_rebuild, &ok, 1, 0);
+	run_bench("sd_boxes_open (255 boxes)", bench_sd_boxes_open, &ok, 1, 0);
+	check(ok, "rebuild and reopen");
+	sd_boxes_close();
+	check(sd_groups_find(0)->numBoxes == CACHE_NUM_BOXES, "opening a group keeps its entry");
+
+	remove("pokebox/boxes/group005.bin");
+	remove("pokebox/boxes/groups.bin");
+}
+
+#define SEARCH_GROUP 7
+#define SEARCH_NUM_BOXES 8
+#define SEARCH_MAX_RESULTS 1024
+
+struct search_ctx {
+	struct sd_search_query query;
+	struct sd_search_result results[SEARCH_MAX_RESULTS];
+	int numResults;
+};
+
+static void fill_search_box(uint8_t *box) {
+	uint8_t pkm[PKM3_SIZE];
+
+	for (int slot = 0; slot < 30; slot++) {
+		make_synthetic_pkm(pkm);
+		if (rng_next() % 4 == 0)
+			memset(pkm, 0, sizeof(pkm));
+		pkm_to_pkmx(box + slot * PKMX_SIZE, pkm, CART_GAME_ID);
+	}
+}
+
+/* The way to search without an index: open every group and decode every slot */
+static void bench_search_decode(void *arg) {
+	struct search_ctx *ctx = arg;
+	const struct sd_group_info *groups;
+	uint8_t box[SD_BOX_SIZE];
+	uint16_t numGroups, numBoxes;
+
+	ctx->numResults = 0;
+	groups = sd_groups_list(&numGroups);
+	for (uint16_t groupIdx = 0; groupIdx < numGroups; groupIdx++) {
+		if (!sd_boxes_open(groups[groupIdx].groupNumber, &numBoxes))
+			continue;
+		for (uint16_t boxIdx = 0; boxIdx < numBoxes; boxIdx++) {
+			if (!sd_boxes_read_box(box, boxIdx))
+				continue;
+			for (int slot = 0; slot < 30; slot++) {
+				struct sd_search_result *result = &ctx->results[ctx->numResults];
+				sd_search_make_entry(&result->entry, box + slot * PKMX_SIZE);
+				if (result->entry.species == 0 || result->entry.species != ctx->query.species ||
+					ctx->numResults >= SEARCH_MAX_RESULTS - 1)
+					continue;
+				result->group = groups[groupIdx].groupNumber;
+				result->box = boxIdx;
+				result->slot = slot;
+				ctx->numResults++;
+			}
+		}
+	}
+	sd_boxes_close();
+}
+
+static void bench_search_index(void *arg) {
+	struct search_ctx *ctx = arg;
+	ctx->numResults = sd_search_find(&ctx->query, ctx->results, SEARCH_MAX_RESULTS);
+}
+
+/* Runs the query both ways and compares where the results are */
+static int search_matches(struct search_ctx *ctx, struct search_ctx *expected) {
+	expected->query = ctx->query;
+	bench_search_decode(expected);
+	bench_search_index(ctx);
+	if (ctx->numResults != expected->numResults || ctx->numResults == 0)
+		return 0;
+	for (int i = 0; i < ctx->numResults; i++) {
+		const struct sd_search_result *a = &ctx->results[i], *b = &expected->results[i];
+		if (a->group != b->group || a->box != b->box || a->slot != b->slot ||
+			memcmp(&a->entry, &b->entry, sizeof(a->entry)) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+static uint32_t search_file_counter(void) {
+	uint8_t header[20] __attribute__((aligned(4))) = {0};
+	FILE *fp = fopen("pokebox/boxes/search007.bin", "rb");
+	if (fp) {
+		fread(header, 1, sizeof(header), fp);
+		fclose(fp);
+	}
+	return GET32(header, 12);
+}
+
+/**
+ * Searches a group of synthetic Pokemon through the index, checking it
+ * against decoding every slot, after incremental updates, and after the
+ * index goes stale.
+ */
+static void run_sd_search_benches(void) {
+	struct search_ctx *ctx = malloc(sizeof(*ctx));
+	struct search_ctx *expected = malloc(sizeof(*expected));
+	uint8_t *boxes = malloc(SEARCH_NUM_BOXES * SD_BOX_SIZE);
+	uint16_t numBoxes;
+	int slot, ok = 1;
+
+	for (int boxIdx = 0; boxIdx < SEARCH_NUM_BOXES; boxIdx++)
+		fill_search_box(boxes + boxIdx * SD_BOX_SIZE);
+	check(sd_boxes_open(SEARCH_GROUP, &numBoxes), "open the search group");
+	for (int boxIdx = 0; boxIdx < SEARCH_NUM_BOXES; boxIdx++)
+		sd_boxes_write_box(boxes + boxIdx * SD_BOX_SIZE, boxIdx);
+	check(sd_boxes_commit(SEARCH_NUM_BOXES), "save the search group");
+	sd_boxes_close();
+
+	// Look for the species of the first Pokemon in the group
+	memset(&ctx->query, 0, sizeof(ctx->query));
+	for (slot = 0; slot < 30 && !ctx->query.species; slot++) {
+		struct sd_search_entry entry;
+		sd_search_make_entry(&entry, boxes + slot * PKMX_SIZE);
+		ctx->query.species = entry.species;
+	}
+	slot--;
+	check(search_matches(ctx, expected), "search index finds a species");
+	run_bench("search by decoding every slot", bench_search_decode, expected, 1, 0);
+	run_bench("sd_search_find", bench_search_index, ctx, 1, 0);
+
+	// Moving that Pokemon updates just the two boxes, and growing the group extends the index
+	memcpy(boxes + 5 * SD_BOX_SIZE + 3 * PKMX_SIZE, boxes + slot * PKMX_SIZE, PKMX_SIZE);
+	memset(boxes + slot * PKMX_SIZE, 0, PKMX_SIZE);
+	check(sd_boxes_open(SEARCH_GROUP, &numBoxes) &&
+		sd_boxes_write_box(boxes, 0) &&
+		sd_boxes_write_box(boxes + 5 * SD_BOX_SIZE, 5) &&
+		sd_boxes_commit(SEARCH_NUM_BOXES + 2), "save a moved Pokemon");
+	sd_boxes_close();
+	check(search_file_counter() == sd_groups_find(SEARCH_GROUP)->saveCounter,
+		"commits update the search index in place");
+	check(search_matches(ctx, expected), "search finds the moved Pokemon");
+
+	// An index that's behind its group gets rebuilt
+	flip_file_byte("pokebox/boxes/search007.bin", 12);
+	check(search_matches(ctx, expected), "stale search index gets rebuilt");
+	check(search_file_counter() == sd_groups_find(SEARCH_GROUP)->saveCounter,
+		"rebuilt search index is current");
+
+	ctx->query.species = 0;
+	ctx->query.flags = SD_SEARCH_SHINY;
+	bench_search_index(ctx);
+	for (int i = 0; i < ctx->numResults; i++)
+		ok &= (ctx->results[i].entry.flags & SD_SEARCH_SHINY) != 0;
+	check(ok, "flag queries only match flagged entries");
+
+	remove("pokebox/boxes/group007.bin");
+	remove("pokebox/boxes/search007.bin");
+	remove("pokebox/boxes/search000.bin");
+	remove("pokebox/boxes/groups.bin");
+	free(boxes);
+	free(expected);
+	free(ctx);
+}
+
+#define PACK_GROUP 8
+#define PACK_NUM_BOXES 32
+
+struct pack_ctx {
+	uint8_t *boxes;
+	uint32_t iteration;
+};
+
+/* Saves every box, changing one byte each time so none are skipped */
+static void bench_sd_save_packed(void *arg) {
+	struct pack_ctx *ctx = arg;
+	sd_boxes_bytes_written = 0;
+	for (uint16_t boxIdx = 0; boxIdx < PACK_NUM_BOXES; boxIdx++) {
+		uint8_t *box = ctx->boxes + boxIdx * SD_BOX_SIZE;
+		box[ctx->iteration % 30 * PKMX_SIZE + 8] ^= 1;
+		sd_boxes_write_box(box, boxIdx);
+	}
+	sd_boxes_commit(PACK_NUM_BOXES);
+	ctx->iteration++;
+}
+
+/**
+ * Saves a group that looks like a real one, with Gen3 Pokemon, empty slots
+ * and empty boxes, which gets packed.
+ */
+static void run_sd_packing_benches(void) {
+	struct pack_ctx ctx;
+	uint8_t box[SD_BOX_SIZE];
+	uint16_t numBoxes;
+	int ok;
+
+	ctx.boxes = calloc(PACK_NUM_BOXES, SD_BOX_SIZE);
+	ctx.iteration = 0;
+	// Like a real group, the last few boxes haven't been filled yet
+	for (int boxIdx = 0; boxIdx < PACK_NUM_BOXES - 8; boxIdx++)
+		fill_search_box(ctx.boxes + boxIdx * SD_BOX_SIZE);
+
+	ok = sd_boxes_open(PACK_GROUP, &numBoxes);
+	bench_sd_save_packed(&ctx);
+	check(ok && sd_boxes_bytes_written < PACK_NUM_BOXES * SD_BOX_SIZE / 2,
+		"typical boxes get packed to under half");
+	run_bench("sd_boxes_save (32 typical boxes)", bench_sd_save_packed, &ctx, 1,
+		sd_boxes_bytes_written);
+	printf("  %-34s %12lu bytes\n", "  written", (unsigned long) sd_boxes_bytes_written);
+	printf("  %-34s %12lu bytes\n", "  unpacked", (unsigned long) PACK_NUM_BOXES * BOX_SIZE_BYTES_X);
+
+	ok = sd_boxes_open(PACK_GROUP, &numBoxes) && numBoxes == PACK_NUM_BOXES;
+	for (uint16_t boxIdx = 0; boxIdx < PACK_NUM_BOXES && ok; boxIdx++) {
+		ok = sd_boxes_read_box(box, boxIdx) == 1 &&
+			memcmp(box, ctx.boxes + boxIdx * SD_BOX_SIZE, SD_BOX_SIZE) == 0;
+	}
+	check(ok, "packed boxes load back");
+	sd_boxes_close();
+
+	remove("pokebox/boxes/group008.bin");
+	free(ctx.boxes);
+}
+
+#define DUPES_GROUP 9
+#define DUPES_NUM_BOXES 64
+#define DUPES_MAX 64
+
+struct dupes_ctx {
+	const uint8_t *cart;
+	uint8_t openGroup;
+	struct pkm_dupe dupes[DUPES_MAX];
+	int numDupes;
+};
+
+static void bench_find_duplicates(void *arg) {
+	struct dupes_ctx *ctx = arg;
+	ctx->numDupes = find_duplicates(ctx->cart, PC_NUM_PKM, CART_GAME_ID,
+		ctx->openGroup, DUPES_NUM_BOXES, ctx->dupes, DUPES_MAX);
+}
+
+/* Returns the set the location is in, or -1 if it isn't a duplicate */
+static int dupe_set(const struct dupes_ctx *ctx, uint8_t group, uint8_t box, uint8_t slot) {
+	for (int i = 0; i < ctx->numDupes; i++) {
+		const struct pkm_dupe *dupe = &ctx->dupes[i];
+		if (dupe->group == group && dupe->box == box && dupe->slot == slot)
+			return dupe->set;
+	}
+	return -1;
+}
+
+/**
+ * Copies a cartridge Pokemon into an SD group and one SD Pokemon to another
+ * box, then checks that both copies are found among a few thousand others.
+ */
+static void run_dupes_benches(void) {
+	struct dupes_ctx *ctx = malloc(sizeof(*ctx));
+	uint8_t *cart = malloc(PC_NUM_PKM * PKM3_SIZE);
+	uint8_t *boxes = malloc(DUPES_NUM_BOXES * SD_BOX_SIZE);
+	uint16_t numBoxes;
+	int slot = 0, cartSet, sdSet;
+
+	for (int i = 0; i < PC_NUM_PKM; i++)
+		make_synthetic_pkm(cart + i * PKM3_SIZE);
+	for (int boxIdx = 0; boxIdx < DUPES_NUM_BOXES; boxIdx++)
+		fill_search_box(boxes + boxIdx * SD_BOX_SIZE);
+	pkm_to_pkmx(boxes + 1 * SD_BOX_SIZE + 2 * PKMX_SIZE, cart + 10 * PKM3_SIZE, CART_GAME_ID);
+	while (boxes[slot * PKMX_SIZE] == 0)
+		slot++;
+	memcpy(boxes + 3 * SD_BOX_SIZE + 29 * PKMX_SIZE, boxes + slot * PKMX_SIZE, PKMX_SIZE);
+
+	check(sd_boxes_open(DUPES_GROUP, &numBoxes), "open the duplicates group");
+	for (int boxIdx = 0; boxIdx < DUPES_NUM_BOXES; boxIdx++)
+		sd_boxes_write_box(boxes + boxIdx * SD_BOX_SIZE, boxIdx);
+	check(sd_boxes_commit(DUPES_NUM_BOXES), "save the duplicates group");
+	sd_boxes_close();
+
+	ctx->cart = cart;
+	ctx->openGroup = DUPES_NO_GROUP;
+	bench_find_duplicates(ctx);
+	cartSet = dupe_set(ctx, DUPES_GROUP_CART, 0, 10);
+	sdSet = dupe_set(ctx, DUPES_GROUP, 0, slot);
+	check(ctx->numDupes == 4 && cartSet >= 0 && sdSet >= 0 && cartSet != sdSet &&
+		dupe_set(ctx, DUPES_GROUP, 1, 2) == cartSet && dupe_set(ctx, DUPES_GROUP, 3, 29) == sdSet,
+		"find_duplicates finds cart and SD copies");
+	run_bench("find_duplicates", bench_find_duplicates, ctx, 1, 0);
+
+	// Move the cart's copy into the open group without saving, and stage a
+	// box that drops the SD copy, like box_cache evictions do
+	check(box_cache_open(DUPES_GROUP, &numBoxes), "open the duplicates group in the box cache");
+	memset(box_cache_get(1) + 2 * PKMX_SIZE, 0, PKMX_SIZE);
+	box_cache_mark_dirty(1);
+	pkm_to_pkmx(box_cache_get(5) + 7 * PKMX_SIZE, cart + 10 * PKM3_SIZE, CART_GAME_ID);
+	box_cache_mark_dirty(5);
+	memset(boxes + 3 * SD_BOX_SIZE + 29 * PKMX_SIZE, 0, PKMX_SIZE);
+	sd_boxes_write_box(boxes + 3 * SD_BOX_SIZE, 3);
+	ctx->openGroup = DUPES_GROUP;
+	bench_find_duplicates(ctx);
+	cartSet = dupe_set(ctx, DUPES_GROUP_CART, 0, 10);
+	check(ctx->numDupes == 2 && cartSet >= 0 && dupe_set(ctx, DUPES_GROUP, 5, 7) == cartSet &&
+		dupe_set(ctx, DUPES_GROUP, 1, 2) < 0 && dupe_set(ctx, DUPES_GROUP, 0, slot) < 0,
+		"find_duplicates sees unsaved changes to the open group");
+	box_cache_close();
+
+	remove("pokebox/boxes/group009.bin");
+	remove("pokebox/boxes/search009.bin");
+	remove("pokebox/boxes/search000.bin");
+	remove("pokebox/boxes/groups.bin");
+	free(boxes);
+	free(cart);
+	free(ctx);
+}
+
+/**
+ * Sorts an SD group through the box cache and checks that the result
+ * matches sorting the same records in memory.
+ */
+static void run_sort_cache_benches(void) {
+	const uint16_t numBoxes = 40; // More than the box cache holds
+	uint8_t *expected = malloc(numBoxes * SD_BOX_SIZE);
+	uint16_t openBoxes = 0;
+	struct box_cache_stats before;
+	int ok;
+
+	remove("pokebox/boxes/group000.bin");
+	for (uint16_t boxIdx = 0; boxIdx < numBoxes; boxIdx++)
+		fill_search_box(expected + boxIdx * SD_BOX_SIZE);
+	ok = sd_boxes_open(0, &openBoxes);
+	for (uint16_t boxIdx = 0; boxIdx < numBoxes && ok; boxIdx++)
+		ok = sd_boxes_write_box(expected + boxIdx * SD_BOX_SIZE, boxIdx);
+	check(ok && sd_boxes_commit(numBoxes), "write a group to sort");
+	sd_boxes_close();
+
+	box_sort_records(expected, numBoxes * 30, 0, BOX_SORT_LEVEL);
+	ok = box_cache_open(0, &openBoxes);
+	before = box_cache_stats;
+	ok = ok && box_sort_cache(0, numBoxes, BOX_SORT_LEVEL) == BOX_SORT_OK;
+	printf("  %-34s %12lu misses %lu write-backs\n", "box_sort_cache (40 boxes)",
+		(unsigned long) (box_cache_stats.misses - before.misses),
+		(unsigned long) (box_cache_stats.writeBacks - before.writeBacks));
+	// Each box is loaded for the snapshot and again to be filled
+	check(box_cache_stats.misses - before.misses <= 2 * numBoxes &&
+		box_cache_stats.writeBacks - before.writeBacks <= numBoxes,
+		"box_sort_cache loads each box at most twice");
+	check(ok && box_cache_save(), "box_sort_cache a 40-box group");
+	box_cache_close();
+	check(access("pokebox/boxes/sort.tmp", F_OK) < 0, "box_sort_cache removes its snapshot");
+	check(box_cache_match_boxes(expected, numBoxes),
+		"box_sort_cache matches box_sort_records");
+	box_cache_close();
+	remove("pokebox/boxes/search000.bin");
+	remove("pokebox/boxes/groups.bin");
+	free(expected);
+}
+
+/**
+ * Saves and loads an SD box group file in a temporary directory, covering
+ * partial writes, an interrupted save, and converting version 0 files.
+ */
+static void run_sd_boxes_benches(void) {
+	char dirname[] = "/tmp/pokebench-sd-XXXXXX";
+	char cwd[1024];
+	struct sd_ctx ctx;
+	uint8_t savedHeader[48];
+	uint8_t *expected;
+	uint16_t damagedBox;
+	uint32_t fullBytes;
+	FILE *fp;
+
+	printf("SD boxes\n");
+	if (!getcwd(cwd, sizeof(cwd)) || !mkdtemp(dirname) || chdir(dirname) < 0) {
+		check(0, "create temporary SD directory");
+		return;
+	}
+
+	ctx.boxData = malloc(SD_NUM_BOXES * SD_BOX_SIZE);
+	expected = malloc(SD_NUM_BOXES * SD_BOX_SIZE);
+	for (int i = 0; i < SD_NUM_BOXES * SD_BOX_SIZE; i++)
+		ctx.boxData[i] = rng_next();
+	ctx.iteration = 0;
+
+	// Version 0 files get converted when they're opened
+	mkdir("pokebox", 0777);
+	mkdir("pokebox/boxes", 0777);
+	write_sd_boxes_v0("pokebox/boxes/group000.bin", ctx.boxData);
+	check(sd_boxes_match(ctx.boxData), "version 0 group file loads");
+	fullBytes = sd_boxes_bytes_written;
+	sd_boxes_close();
+	fp = fopen("pokebox/boxes/group000.bin", "rb");
+	check(fp && fread(savedHeader, 1, sizeof(savedHeader), fp) == sizeof(savedHeader) &&
+		GET16(savedHeader, 8) == 1, "version 0 group file converts");
+	if (fp)
+		fclose(fp);
+	check(sd_boxes_match(ctx.boxData), "converted group file loads");
+
+	ctx.dirtyBoxes = 1;
+	bench_sd_save(&ctx);
+	run_bench("sd_boxes_save (1 changed box)", bench_sd_save, &ctx, 1, sd_boxes_bytes_written);
+	printf("  %-34s %12lu bytes\n", "  written", (unsigned long) sd_boxes_bytes_written);
+	check(sd_boxes_bytes_written < fullBytes / 8, "saving one box writes only that box");
+	check(sd_boxes_match(ctx.boxData), "partial saves load back");
+
+	ctx.dirtyBoxes = SD_NUM_BOXES;
+	bench_sd_save(&ctx);
+	run_bench("sd_boxes_save (every box)", bench_sd_save, &ctx, 1, sd_boxes_bytes_written);
+	printf("  %-34s %12lu bytes\n", "  written", (unsigned long) sd_boxes_bytes_written);
+	check(sd_boxes_match(ctx.boxData), "full saves load back");
+
+	// Losing power right before the header flip has to leave the previous save intact
+	memcpy(expected, ctx.boxData, SD_NUM_BOXES * SD_BOX_SIZE);
+	fp = fopen("pokebox/boxes/group000.bin", "rb");
+	check(fp && fread(savedHeader, 1, sizeof(savedHeader), fp) == sizeof(savedHeader),
+		"read group file header");
+	if (fp)
+		fclose(fp);
+	ctx.dirtyBoxes = 3;
+	bench_sd_save(&ctx);
+	sd_boxes_close();
+	fp = fopen("pokebox/boxes/group000.bin", "r+b");
+	if (fp) {
+		fwrite(savedHeader, 1, sizeof(savedHeader), fp);
+		fclose(fp);
+	}
+	check(sd_boxes_match(expected), "interrupted save keeps the previous boxes");
+
+	// Boxes written without a commit are dropped when the group is closed
+	for (uint16_t boxIdx = 0; boxIdx < SD_NUM_BOXES; boxIdx++)
+		sd_boxes_write_box(ctx.boxData + boxIdx * SD_BOX_SIZE, boxIdx);
+	check(sd_boxes_match(expected), "closing without a commit discards staged boxes");
+
+	// A damaged box falls back to its copy from the previous save
+	// The save changes only one box, so expected still has its previous copy
+	memcpy(ctx.boxData, expected, SD_NUM_BOXES * SD_BOX_SIZE);
+	damagedBox = ctx.iteration % SD_NUM_BOXES;
+	ctx.dirtyBoxes = 1;
+	bench_sd_save(&ctx);
+	sd_boxes_close();
+	check(damage_group_file(ctx.boxData + damagedBox * SD_BOX_SIZE), "damage a box record");
+	check(sd_boxes_match(expected), "damaged box loads its previous copy");
+
+	// A damaged directory falls back to the whole previous save
+	memcpy(ctx.boxData, expected, SD_NUM_BOXES * SD_BOX_SIZE);
+	for (uint16_t boxIdx = 0; boxIdx < SD_NUM_BOXES; boxIdx++)
+		sd_boxes_write_box(ctx.boxData + boxIdx * SD_BOX_SIZE, boxIdx);
+	sd_boxes_commit(SD_NUM_BOXES);
+	bench_sd_save(&ctx);
+	sd_boxes_close();
+	check(damage_group_file(NULL), "damage the box directory");
+	check(sd_boxes_match(expected), "damaged directory loads the previous save");
+	sd_boxes_close();
+
+	run_box_cache_benches();
+	run_sd_groups_benches();
+	run_sd_search_benches();
+	run_sd_packing_benches();
+	run_dupes_benches();
+	run_sort_cache_benches();
+
+	remove("pokebox/boxes/group000.bin");
+	rmdir("pokebox/boxes");
+	rmdir("pokebox");
+	check(chdir(cwd) == 0 && rmdir(dirname) == 0, "remove temporary SD directory");
+	free(expected);
+	free(ctx.boxData);
+}
+
+#define COPY_SIZE (1024 * 1024)
+#define DUMP_ITEM_SIZE 1024
+#define DUMP_NUM_ITEMS 440
+
+struct file_ctx {
+	const char *path;
+	FILE *fp;
+	uint8_t *data;
+	int ok;
+};
+
+/* The copy loop sd_boxes.c used to have: a seek, read, seek and write per KiB */
+static void bench_copy_1k(void *arg) {
+	struct file_ctx *ctx = arg;
+	uint8_t buffer[1024];
+	for (uint32_t pos = 0; pos < COPY_SIZE; pos += sizeof(buffer)) {
+		ctx->ok &=
+			fseek(ctx->fp, pos, SEEK_SET) == 0 &&
+			fread(buffer, 1, sizeof(buffer), ctx->fp) == sizeof(buffer) &&
+			fseek(ctx->fp, COPY_SIZE + pos, SEEK_SET) == 0 &&
+			fwrite(buffer, 1, sizeof(buffer), ctx->fp) == sizeof(buffer);
+	}
+	fflush(ctx->fp);
+}
+
+static void bench_copy_sd_file(void *arg) {
+	struct file_ctx *ctx = arg;
+	ctx->ok &= sd_file_copy(ctx->fp, COPY_SIZE, ctx->fp, 0, COPY_SIZE, NULL);
+	fflush(ctx->fp);
+}
+
+/* Same write pattern as write_boxicons: a header, then one fwrite per icon */
+static void dump_items(struct file_ctx *ctx, FILE *fp) {
+	if (!fp) {
+		ctx->ok = 0;
+		return;
+	}
+	fwrite(ctx->data, 1, 24, fp);
+	for (int i = 0; i < DUMP_NUM_ITEMS; i++)
+		fwrite(ctx->data + i * DUMP_ITEM_SIZE, 1, DUMP_ITEM_SIZE, fp);
+	ctx->ok &= !ferror(fp);
+	fclose(fp);
+}
+
+static void bench_dump_fopen(void *arg) {
+	struct file_ctx *ctx = arg;
+	dump_items(ctx, fopen(ctx->path, "wb"));
+}
+
+static void bench_dump_sd_fopen(void *arg) {
+	struct file_ctx *ctx = arg;
+	dump_items(ctx, sd_fopen(ctx->path, "wb", SD_FILE_SEQUENTIAL));
+}
+
+/**
+ * Compares the old 1 KiB copy loop and default stdio buffering against
+ * sd_file_copy and sd_fopen. On the host the OS page cache hides most of
+ * the difference that libfat shows.
+ */
+static void run_file_benches(void) {
+	char filename[] = "/tmp/pokebench-file-XXXXXX";
+	struct file_ctx ctx;
+	uint8_t *copied;
+	int fd;
+
+	printf("SD file transfers\n");
+	fd = mkstemp(filename);
+	ctx.fp = fd < 0 ? NULL : fdopen(fd, "w+b");
+	if (!ctx.fp) {
+		check(0, "create temporary file");
+		return;
+	}
+	ctx.path = filename;
+	ctx.ok = 1;
+	ctx.data = malloc(COPY_SIZE);
+	copied = malloc(COPY_SIZE);
+	for (int i = 0; i < COPY_SIZE; i++)
+		ctx.data[i] = rng_next();
+	fwrite(ctx.data, 1, COPY_SIZE, ctx.fp);
+
+	run_bench("copy, 1 KiB seek/read/write", bench_copy_1k, &ctx, 1, COPY_SIZE);
+	run_bench("copy, sd_file_copy", bench_copy_sd_file, &ctx, 1, COPY_SIZE);
+	// An odd offset gives sd_file_copy a short first chunk
+	check(sd_file_copy(ctx.fp, COPY_SIZE + 100, ctx.fp, 100, COPY_SIZE - 100, NULL) &&
+		fseek(ctx.fp, COPY_SIZE, SEEK_SET) == 0 &&
+		fread(copied, 1, COPY_SIZE, ctx.fp) == COPY_SIZE &&
+		memcmp(copied, ctx.data, COPY_SIZE) == 0, "sd_file_copy copies the data");
+	fclose(ctx.fp);
+
+	run_bench("asset dump, fopen", bench_dump_fopen, &ctx, 1,
+		DUMP_NUM_ITEMS * DUMP_ITEM_SIZE);
+	run_bench("asset dump, sd_fopen", bench_dump_sd_fopen, &ctx, 1,
+		DUMP_NUM_ITEMS * DUMP_ITEM_SIZE);
+	check(ctx.ok, "file transfers succeed");
+
+	remove(filename);
+	free(copied);
+	free(ctx.data);
+}
+
+/* The loop pkm3_to_simplepkm used before gen3_exp_to_level */
+static uint8_t exp_to_level_linear(unsigned growth, uint32_t exp) {
+	uint8_t level;
+	for (level = 0; level < 100; level++) {
+		if (exp < experienceTables[growth][level])
+			break;
+	}
+	return level;
+}
+
+struct level_ctx {
+	uint32_t exps[1024];
+	uint32_t sink;
+};
+
+static void bench_level_linear(void *arg) {
+	struct level_ctx *ctx = arg;
+	for (int i = 0; i < 1024; i++)
+		ctx->sink += exp_to_level_linear(i % 6, ctx->exps[i]);
+}
+
+static void bench_level_search(void *arg) {
+	struct level_ctx *ctx = arg;
+	for (int i = 0; i < 1024; i++)
+		ctx->sink += gen3_exp_to_level(i % 6, ctx->exps[i], NULL);
+}
+
+static void run_level_benches(void) {
+	struct level_ctx ctx;
+	int matches = 1;
+
+	printf("levels\n");
+	// Every experience value up to past the level 100 threshold of each growth rate
+	for (unsigned growth = 0; growth < 6 && matches; growth++) {
+		uint32_t maxExp = experienceTables[growth][99] + 2;
+		for (uint32_t exp = 0; exp <= maxExp; exp++) {
+			uint32_t toNext;
+			uint8_t level = gen3_exp_to_level(growth, exp, &toNext);
+			if (level != exp_to_level_linear(growth, exp) ||
+				toNext != (level < 100 ? experienceTables[growth][level] - exp : 0)) {
+				matches = 0;
+				break;
+			}
+		}
+		if (gen3_exp_to_level(growth, UINT32_MAX, NULL) != 100)
+			matches = 0;
+	}
+	check(matches, "gen3_exp_to_level matches the linear scan");
+
+	for (int i = 0; i < 1024; i++)
+		ctx.exps[i] = rng_next() % (experienceTables[i % 6][99] + 1);
+	ctx.sink = 0;
+	run_bench("exp to level (linear scan)", bench_level_linear, &ctx, 1024, 0);
+	run_bench("gen3_exp_to_level", bench_level_search, &ctx, 1024, 0);
+}
+
+#define SORT_NUM_BOXES 32
+
+struct sort_ctx {
+	const uint8_t *unsorted;
+	uint8_t *records;
+	uint16_t count;
+	uint16_t gameId;
+	enum BoxSortKey key;
+};
+
+static void bench_sort(void *arg) {
+	struct sort_ctx *ctx = arg;
+	uint16_t size = ctx->gameId ? PKM3_SIZE : PKMX_SIZE;
+	memcpy(ctx->records, ctx->unsorted, ctx->count * size);
+	box_sort_records(ctx->records, ctx->count, ctx->gameId, ctx->key);
+}
+
+/* Adds up CRCs of every record, which sorting must not change */
+static uint32_t records_digest(const uint8_t *records, uint16_t count, uint16_t size) {
+	uint32_t digest = 0;
+	for (uint16_t i = 0; i < count; i++)
+		digest += crc32(records + i * size, size, 0);
+	return digest;
+}
+
+/**
+ * Checks that the records are in key order with every empty slot last.
+ * Only the keys that are easy to recompute from a SimplePKM are checked.
+ */
+static int records_sorted(const uint8_t *records, uint16_t count, uint16_t gameId,
+	enum BoxSortKey key) {
+	uint16_t size = gameId ? PKM3_SIZE : PKMX_SIZE;
+	struct SimplePKM prev, pkm;
+
+	memset(&prev, 0, sizeof(prev));
+	prev.exists = 1;
+	prev.level = 0xFF;
+	for (uint16_t i = 0; i < count; i++) {
+		memset(&pkm, 0, sizeof(pkm));
+		pkm.isOnCart = gameId != 0;
+		if (gameId)
+			pkm3_to_simplepkm(&pkm, records + i * size);
+		else
+			pkmx_to_simplepkm(&pkm, records + i * size, 0);
+		if (pkm.exists && !prev.exists)
+			return 0;
+		if (pkm.exists && key == BOX_SORT_DEX && !pkm.isEgg &&
+			(prev.isEgg || pkm.dexNumber < prev.dexNumber))
+			return 0;
+		if (pkm.exists && key == BOX_SORT_LEVEL && pkm.level > prev.level)
+			return 0;
+		prev = pkm;
+	}
+	return 1;
+}
+
+/**
+ * Sorts a 32-box group of PKMX records and a cartridge's PK3 boxes.
+ */
+static void run_sort_benches(void) {
+	struct sort_ctx ctx;
+	uint8_t *unsorted = malloc(SORT_NUM_BOXES * SD_BOX_SIZE);
+	uint32_t digest;
+	int ok = 1;
+
+	printf("box sorting\n");
+	for (int boxIdx = 0; boxIdx < SORT_NUM_BOXES; boxIdx++)
+		fill_search_box(unsorted + boxIdx * SD_BOX_SIZE);
+	ctx.unsorted = unsorted;
+	ctx.records = malloc(SORT_NUM_BOXES * SD_BOX_SIZE);
+	ctx.count = SORT_NUM_BOXES * 30;
+	ctx.gameId = 0;
+	digest = records_digest(unsorted, ctx.count, PKMX_SIZE);
+	for (ctx.key = 0; ctx.key < BOX_SORT_KEY_COUNT; ctx.key++) {
+		bench_sort(&ctx);
+		ok &= records_sorted(ctx.records, ctx.count, 0, ctx.key) &&
+			records_digest(ctx.records, ctx.count, PKMX_SIZE) == digest;
+	}
+	check(ok, "sorted PKMX records are in order and all there");
+	ctx.key = BOX_SORT_DEX;
+	run_bench("box_sort_records (32 boxes, dex)", bench_sort, &ctx, 1, 0);
+	ctx.key = BOX_SORT_STAT_TOTAL;
+	run_bench("box_sort_records (32 boxes, stats)", bench_sort, &ctx, 1, 0);
+
+	// Sorting again by the same key must not move anything
+	memcpy(unsorted, ctx.records, ctx.count * PKMX_SIZE);
+	box_sort_records(ctx.records, ctx.count, 0, ctx.key);
+	check(memcmp(unsorted, ctx.records, ctx.count * PKMX_SIZE) == 0, "sorting is stable");
+
+	for (int i = 0; i < PC_NUM_PKM; i++) {
+		if (rng_next() % 4)
+			make_synthetic_pkm(unsorted + i * PKM3_SIZE);
+		else
+			memset(unsorted + i * PKM3_SIZE, 0, PKM3_SIZE);
+	}
+	ctx.count = PC_NUM_PKM;
+	ctx.gameId = CART_GAME_ID;
+	ctx.key = BOX_SORT_LEVEL;
+	digest = records_digest(unsorted, ctx.count, PKM3_SIZE);
+	bench_sort(&ctx);
+	check(records_sorted(ctx.records, ctx.count, CART_GAME_ID, ctx.key) &&
+		records_digest(ctx.records, ctx.count, PKM3_SIZE) == digest,
+		"sorted PK3 records are in order and all there");
+	run_bench("box_sort_records (14 PK3 boxes)", bench_sort, &ctx, 1, 0);
+
+	free(ctx.records);
+	free(unsorted);
+}
+
+static int read_save_file(const char *filename, uint8_t *flash) {
+	FILE *fp;
+	size_t len;
+
+	fp = fopen(filename, "rb");
+	if (!fp) {
+		perror(filename);
+		return 0;
+	}
+	memset(flash, 0xFF, FLASH_SIZE);
+	len = fread(flash, 1, FLASH_SIZE, fp);
+	fclose(fp);
+	if (len < 0x1c000) {
+		fprintf(stderr, "%s: not a Gen3 save file\n", filename);
+		return 0;
+	}
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	uint8_t *flash;
+	int opt;
+
+	host_init_basestats();
+	while ((opt = getopt(argc, argv, "qb:")) != -1) {
+		if (opt == 'q') {
+			min_run_ns = 2000000;
+		} else if (opt == 'b') {
+			if (!host_load_basestats(optarg)) {
+				fprintf(stderr, "%s: can't read base stat dump\n", optarg);
+				return 2;
+			}
+		} else {
+			fprintf(stderr, "Usage: %s [-q] [-b basestats03.bin] [file.sav ...]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	flash = malloc(FLASH_SIZE);
+	make_synthetic_flash(flash);
+	run_save_benches("synthetic.sav", flash);
+	run_write_benches(flash);
+
+	for (int i = optind; i < argc; i++) {
+		if (read_save_file(argv[i], flash))
+			run_save_benches(argv[i], flash);
+		else
+			failures++;
+	}
+	free(flash);
+
+	run_buffer_benches();
+	run_level_benches();
+	run_sort_benches();
+	run_file_benches();
+	run_sd_boxes_benches();
+
+	if (failures) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
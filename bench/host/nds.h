@@ -0,0 +1,50 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+/* Minimal stand-in for libnds so the hardware-independent modules in
+ * source/ can be built for the host. Only what those modules actually use
+ * belongs here; anything touching real DS hardware stays out of the host build.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+#define iprintf printf
+
+// Slot-2 SRAM/flash window. The host build never talks to a cartridge.
+extern uint8_t host_sram[0x10000];
+#define SRAM (host_sram)
+
+static inline void swiDelay(uint32_t duration) {
+	(void) duration;
+}
+
+static inline void sysSetBusOwners(bool arm9rom, bool arm9card) {
+	(void) arm9rom;
+	(void) arm9card;
+}
+
+// Plain C version of the BIOS LZ77 decompressor, the baseline for lz77_extract
+void swiDecompressLZSSWram(void *source, void *destination);
@@ -0,0 +1,149 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+/* Host replacements for the parts of asset_manager.c, message_window.c and
+ * gba_flash.c that the benchmarked modules link against.
+ */
+#include "host_stubs.h"
+
+#include <nds.h>
+#include <stdarg.h>
+
+#include "asset_manager.h"
+#include "gba_flash.h"
+#include "message_window.h"
+#include "util.h"
+
+uint8_t host_sram[0x10000];
+
+const char *activeGameName = "Host";
+const char *activeGameNameShort = "Host";
+int activeGameId = GAMEID_EMERALD;
+int activeGameLanguage = LANG_ENGLISH;
+uint8_t activeGameGen = 3;
+uint8_t activeGameSubGen = GAMEID_EMERALD;
+
+// Same layout as basestats03.bin entries: the RSE entry plus FRLG held items
+static struct {
+	struct BaseStatEntryGen3 entry;
+	uint32_t heldItemsFRLG;
+} baseStats[440];
+
+void host_init_basestats(void) {
+	// Deterministic but varied enough to exercise every growth rate and gender ratio
+	for (int i = 0; i < 440; i++) {
+		struct BaseStatEntryGen3 *entry = &baseStats[i].entry;
+		memset(entry, 0, sizeof(*entry));
+		for (int stat = 0; stat < 6; stat++)
+			entry->stats[stat] = 20 + (i * 7 + stat * 31) % 130;
+		entry->type[0] = i % 18;
+		entry->type[1] = (i / 3) % 18;
+		entry->genderRatio = (i % 11 == 0) ? 0xFF : (i * 37) & 0xFF;
+		entry->expGrowth = i % 6;
+		entry->ability[0] = 1 + i % 76;
+		entry->ability[1] = (i & 1) ? 1 + (i / 2) % 76 : 0;
+	}
+}
+
+int host_load_basestats(const char *filename) {
+	FILE *fp;
+	int ok;
+
+	fp = fopen(filename, "rb");
+	if (!fp)
+		return 0;
+	// Skip the 24-byte dump header
+	ok = fseek(fp, 24, SEEK_SET) == 0 &&
+		fread(baseStats, sizeof(baseStats[0]), 440, fp) == 440;
+	fclose(fp);
+	return ok;
+}
+
+const struct BaseStatEntryGen3* getBaseStatEntry(uint16_t species, uint16_t gameid) {
+	(void) gameid;
+	if (species >= 440)
+		species = 0;
+	return &baseStats[species].entry;
+}
+
+void open_message_window(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+void set_message_screen(int screen) {
+	(void) screen;
+}
+
+// Benchmarks only ever load and save through files; there is no cartridge
+struct gba_flash_stats gba_flash_stats;
+
+const struct gba_flash_chip* gba_flash_init(void) {
+	return NULL;
+}
+
+int gba_flash_read(uint8_t *out, uint32_t offset, uint32_t size) {
+	(void) out;
+	(void) offset;
+	(void) size;
+	return 0;
+}
+
+int gba_flash_write(const uint8_t *data, uint32_t offset, uint32_t size) {
+	(void) data;
+	(void) offset;
+	(void) size;
+	return 0;
+}
+
+uint32_t gba_flash_ticks_to_ms(uint32_t ticks) {
+	return ticks;
+}
+
+/* Straightforward LZ77 (type 0x10) decoder with the same behavior as the
+ * BIOS call: no bounds checking, output size comes from the header.
+ */
+void swiDecompressLZSSWram(void *source, void *destination) {
+	const uint8_t *src = source;
+	uint8_t *dest = destination;
+	uint32_t remaining = GET32(src, 0) >> 8;
+
+	src += 4;
+	while (remaining) {
+		uint8_t flags = *src++;
+		for (int i = 0; i < 8 && remaining; i++, flags <<= 1) {
+			if ((flags & 0x80) == 0) {
+				*dest++ = *src++;
+				remaining--;
+			} else {
+				uint32_t len = (src[0] >> 4) + 3;
+				uint32_t disp = (((src[0] & 0xF) << 8) | src[1]) + 1;
+				src += 2;
+				if (len > remaining)
+					len = remaining;
+				remaining -= len;
+				while (len--) {
+					*dest = *(dest - disp);
+					dest++;
+				}
+			}
+		}
+	}
+}
@@ -27,6 +27,7 @@
 #include "lz77.h"
 #include "message_window.h"
 #include "pokemon_strings.h"
+#include "sd_file.h"
 #include "util.h"
 
 #include "unknownFront.h"
@@ -51,6 +52,60 @@ int activeGameLanguage;
 uint8_t activeGameGen;
 uint8_t activeGameSubGen;
 
+/* Box icons read from a ROM file or the SD dump are kept in a small LRU
+ * cache, so switching boxes doesn't read the same icons from the SD card
+ * again. Buffering every icon would take about 1 MB, but two screens of
+ * boxes only show 60 at a time. iconCacheIndex maps each species of each
+ * source to the slot holding its icon.
+ */
+#define ICON_CACHE_SLOTS 64
+#define ICON_CACHE_SPECIES 440
+#define ICON_CACHE_NONE 0xFF
+
+struct icon_cache_slot {
+	uint16_t species; // With the generation in the top 4 bits, like getIconImage
+	uint16_t unused;
+	uint32_t lastUse;
+};
+
+struct icon_cache_stats icon_cache_stats;
+
+static uint16_t iconCacheTiles[ICON_CACHE_SLOTS][512];
+static struct icon_cache_slot iconCacheSlots[ICON_CACHE_SLOTS];
+// Index 0 is for the ROM file's icons and 1 for the SD dump's
+static uint8_t iconCacheIndex[2][ICON_CACHE_SPECIES];
+static uint32_t iconCacheClock;
+
+static void clear_icon_cache(void) {
+	memset(iconCacheIndex, ICON_CACHE_NONE, sizeof(iconCacheIndex));
+	memset(iconCacheSlots, 0, sizeof(iconCacheSlots));
+	iconCacheClock = 0;
+}
+
+/* Decoded front sprites are kept in an LRU cache as well. Both summary
+ * panes show the hovered Pokemon's sprite, and the box GUI prefetches the
+ * ones next to the cursor, so hovering usually doesn't need the SD card or
+ * the LZ77 decoder. Only the first 64x64 frame of each sprite is kept.
+ */
+#define FRONT_CACHE_SLOTS 8
+
+struct front_cache_entry {
+	uint32_t key; // 0 for unused entries, see front_cache_key
+	uint32_t lastUse;
+	uint8_t palette[32];
+	uint8_t tiles[2048];
+};
+
+struct front_cache_stats front_cache_stats;
+
+static struct front_cache_entry frontCache[FRONT_CACHE_SLOTS];
+static uint32_t frontCacheClock;
+
+static void clear_front_cache(void) {
+	memset(frontCache, 0, sizeof(frontCache));
+	frontCacheClock = 0;
+}
+
 // Each sprite is 2048 bytes
 // Need to allocate enough space for 4 sprites because of Castform
 static uint8_t tileGfxUncompressed[8192];
@@ -61,6 +116,7 @@ typedef struct assets_handler {
 	char *file;
 
 	uint16_t **iconImageTable;
+	uint32_t *iconImageAddresses; // The ROM file's iconImageTable, read once
 	uint8_t *iconPaletteIndices;
 	uint16_t **iconPaletteTable;
 	uint16_t **frontSpriteTable;
@@ -69,6 +125,9 @@ typedef struct assets_handler {
 	uint16_t **wallpaperTable;
 	uint16_t **itemIconTable;
 	uint8_t *baseStatTable;
+	// Loaded into RAM once: the active game's table, and the unified table from the SD dump
+	const struct BaseStatEntryGen3 *baseStats;
+	struct BaseStatEntryUnifiedGen3 *baseStatsSD;
 	int game;
 	int language;
 	FILE *fp;
@@ -365,13 +424,39 @@ static bool initFromHeader(tGBAHeader *header) {
 	return has_name && has_language && has_offsets;
 }
 
+/**
+ * Reads the whole base stat dump into RAM. The file handle stays open for
+ * write_basestats to merge in other games' data.
+ */
+static void load_basestats_sd() {
+	FILE *fp = handler.baseStatFile;
+	size_t size = 440 * sizeof(struct BaseStatEntryUnifiedGen3);
+
+	if (!fp) {
+		free(handler.baseStatsSD);
+		handler.baseStatsSD = NULL;
+		return;
+	}
+	if (!handler.baseStatsSD)
+		handler.baseStatsSD = malloc(size);
+	if (handler.baseStatsSD) {
+		fseek(fp, 24, SEEK_SET);
+		if (fread(handler.baseStatsSD, 1, size, fp) != size) {
+			free(handler.baseStatsSD);
+			handler.baseStatsSD = NULL;
+		}
+	}
+}
+
 void assets_init() {
 	char fname[44];
 	struct dump_file_header header;
 	FILE *fp;
 	int error;
 
-	handler.iconFile = fp = fopen("/pokebox/assets/boxicons03.bin", "rb");
+	clear_icon_cache();
+	clear_front_cache();
+	handler.iconFile = fp = sd_fopen("/pokebox/assets/boxicons03.bin", "rb", SD_FILE_RANDOM);
 	if (fp) {
 		fread(&header, sizeof(header), 1, fp);
 		error =
@@ -387,7 +472,7 @@ void assets_init() {
 		}
 	}
 
-	handler.itemIconFile = fp = fopen("/pokebox/assets/items03.bin", "rb");
+	handler.itemIconFile = fp = sd_fopen("/pokebox/assets/items03.bin", "rb", SD_FILE_RANDOM);
 	if (fp) {
 		fread(&header, sizeof(header), 1, fp);
 		error =
@@ -401,7 +486,7 @@ void assets_init() {
 		}
 	}
 
-	handler.baseStatFile = fp = fopen("/pokebox/assets/basestats03.bin", "rb");
+	handler.baseStatFile = fp = sd_fopen("/pokebox/assets/basestats03.bin", "rb", SD_FILE_RANDOM);
 	if (fp) {
 		fread(&header, sizeof(header), 1, fp);
 		error =
@@ -416,10 +501,11 @@ void assets_init() {
 			handler.baseStatFile = NULL;
 		}
 	}
+	load_basestats_sd();
 
 	for (int i = 0; i < 2; i++) {
 		snprintf(fname, sizeof(fname), "/pokebox/assets/frontsprites03%02d.bin", i);
-		handler.frontSpriteFiles[i] = fopen(fname, "rb");
+		handler.frontSpriteFiles[i] = sd_fopen(fname, "rb", SD_FILE_RANDOM);
 	}
 
 	if (handler.iconFile) {
@@ -446,6 +532,8 @@ bool assets_init_cart() {
 	handler.fp = NULL;
 	if (!initFromHeader(&GBA_HEADER))
 		return false;
+	// The cartridge ROM is memory-mapped, so its table can be used in place
+	handler.baseStats = (const struct BaseStatEntryGen3*) handler.baseStatTable;
 	memcpy(handler.palettesData + 3 * 32, handler.iconPaletteTable[0], 3 * 32);
 	dump_assets_to_sd(false);
 	return true;
@@ -454,10 +542,11 @@ bool assets_init_cart() {
 bool assets_init_romfile(const char *file) {
 	tGBAHeader header;
 	uint8_t *indicesCopy;
+	struct BaseStatEntryGen3 *baseStatsCopy;
 
 	assets_free();
 	handler.assetSource = ASSET_SOURCE_ROMFILE;
-	handler.fp = fopen(file, "rb");
+	handler.fp = sd_fopen(file, "rb", SD_FILE_RANDOM);
 	if (handler.fp == NULL)
 		return false;
 	fread(&header, sizeof(header), 1, handler.fp);
@@ -469,6 +558,12 @@ bool assets_init_romfile(const char *file) {
 		return false;
 	}
 
+	handler.iconImageAddresses = malloc(ICON_CACHE_SPECIES * sizeof(uint32_t));
+	if (handler.iconImageAddresses) {
+		fseek(handler.fp, (long) handler.iconImageTable & ROM_OFFSET_MASK, SEEK_SET);
+		fread(handler.iconImageAddresses, sizeof(uint32_t), ICON_CACHE_SPECIES, handler.fp);
+	}
+
 	indicesCopy = malloc(440);
 	fseek(handler.fp, (long) handler.iconPaletteIndices & ROM_OFFSET_MASK, SEEK_SET);
 	fread(indicesCopy, 1, 440, handler.fp);
@@ -480,6 +575,13 @@ bool assets_init_romfile(const char *file) {
 	fseek(handler.fp, (long) palAddress & ROM_OFFSET_MASK, SEEK_SET);
 	fread(handler.palettesData + 32 * 3, 1, 32 * 3, handler.fp);
 
+	baseStatsCopy = malloc(440 * sizeof(struct BaseStatEntryGen3));
+	if (baseStatsCopy) {
+		fseek(handler.fp, (long) handler.baseStatTable & ROM_OFFSET_MASK, SEEK_SET);
+		fread(baseStatsCopy, sizeof(struct BaseStatEntryGen3), 440, handler.fp);
+	}
+	handler.baseStats = baseStatsCopy;
+
 	dump_assets_to_sd(false);
 	return true;
 }
@@ -489,6 +591,13 @@ void assets_free() {
 		fclose(handler.fp);
 	if ((uint16_t*) handler.iconPaletteIndices < GBAROM)
 		free(handler.iconPaletteIndices);
+	if ((uint16_t*) handler.baseStats < GBAROM)
+		free((void*) handler.baseStats);
+	handler.baseStats = NULL;
+	free(handler.iconImageAddresses);
+	handler.iconImageAddresses = NULL;
+	clear_icon_cache();
+	clear_front_cache();
 	//memset(&handler, 0, sizeof(handler));
 	activeGameName = "Unknown";
 	activeGameNameShort = "Unknown";
@@ -502,7 +611,7 @@ int read_romfile_gameid(const char *file) {
 	uint32_t gamecode;
 	tGBAHeader header;
 
-	fp = fopen(file, "rb");
+	fp = sd_fopen(file, "rb", SD_FILE_RANDOM);
 	if (fp == NULL)
 		return -1;
 
@@ -530,33 +639,78 @@ uint32_t readRomWord(void *address) {
 	return out;
 }
 
+/**
+ * Returns the cache slot to read an icon into, evicting the least recently
+ * used one.
+ */
+static uint16_t* claim_icon_slot(uint16_t species) {
+	struct icon_cache_slot *slot;
+	int slotIdx = 0;
+
+	for (int i = 1; i < ICON_CACHE_SLOTS; i++) {
+		if (iconCacheSlots[i].lastUse < iconCacheSlots[slotIdx].lastUse)
+			slotIdx = i;
+	}
+	slot = &iconCacheSlots[slotIdx];
+	if (slot->lastUse)
+		iconCacheIndex[slot->species >> 12 != 0][slot->species & 0xFFF] = ICON_CACHE_NONE;
+	slot->species = species;
+	slot->lastUse = ++iconCacheClock;
+	iconCacheIndex[species >> 12 != 0][species & 0xFFF] = slotIdx;
+	return iconCacheTiles[slotIdx];
+}
+
+static void read_icon(uint16_t *tiles, uint16_t species) {
+	uint8_t gen = species >> 12;
+	uint32_t imageAddress;
+
+	species &= 0xFFF;
+	if (gen != 0) {
+		fseek(handler.iconFile, 24 + 4 + 32 * 3 + 440 + species * 1024, SEEK_SET);
+		fread(tiles, 2, 512, handler.iconFile);
+		return;
+	}
+	if (handler.iconImageAddresses) {
+		imageAddress = handler.iconImageAddresses[species];
+	} else {
+		fseek(handler.fp, (long) (handler.iconImageTable + species) & ROM_OFFSET_MASK, SEEK_SET);
+		fread(&imageAddress, 4, 1, handler.fp);
+	}
+	fseek(handler.fp, (long) imageAddress & ROM_OFFSET_MASK, SEEK_SET);
+	fread(tiles, 2, 512, handler.fp);
+}
+
 const uint16_t* getIconImage(uint16_t species) {
 	uint8_t gen;
+	uint8_t slotIdx;
+	uint16_t *tiles;
 
 	gen = species >> 12;
-	species &= 0xFFF;
 
 	if (gen != 0) {
 		if (!handler.iconFile)
 			return (const uint16_t*) unknownIconTiles;
-		fseek(handler.iconFile, 24 + 4 + 32 * 3 + 440 + species * 1024, SEEK_SET);
-		fread(handler.buffer, 2, 512, handler.iconFile);
-		return (const uint16_t*) handler.buffer;
+	} else {
+		if (handler.assetSource == ASSET_SOURCE_NONE)
+			return (const uint16_t*) unknownIconTiles;
+		if (handler.assetSource == ASSET_SOURCE_CART)
+			return handler.iconImageTable[species];
 	}
 
-	if (handler.assetSource == ASSET_SOURCE_NONE)
-		return (const uint16_t*) unknownIconTiles;
-	if (handler.assetSource == ASSET_SOURCE_CART)
-		return handler.iconImageTable[species];
-
-	// Buffering this table would require 440 species * 4B = 1760 bytes
-	uint16_t* imageAddress = NULL;
-	fseek(handler.fp, (long) (handler.iconImageTable + species) & ROM_OFFSET_MASK, SEEK_SET);
-	fread(&imageAddress, 4, 1, handler.fp);
-	// Buffering every image would require about 1MB
-	fseek(handler.fp, (long) imageAddress & ROM_OFFSET_MASK, SEEK_SET);
-	fread(handler.buffer, 2, 512, handler.fp);
-	return (const uint16_t*) handler.buffer;
+	if ((species & 0xFFF) >= ICON_CACHE_SPECIES) {
+		read_icon((uint16_t*) handler.buffer, species);
+		return (const uint16_t*) handler.buffer;
+	}
+	slotIdx = iconCacheIndex[gen != 0][species & 0xFFF];
+	if (slotIdx != ICON_CACHE_NONE) {
+		icon_cache_stats.hits++;
+		iconCacheSlots[slotIdx].lastUse = ++iconCacheClock;
+		return iconCacheTiles[slotIdx];
+	}
+	icon_cache_stats.misses++;
+	tiles = claim_icon_slot(species);
+	read_icon(tiles, species);
+	return tiles;
 }
 
 uint8_t getIconPaletteIdx(uint16_t species) {
@@ -629,12 +783,14 @@ int loadWallpaper(int index) {
 		// Read the compressed tile data
 		fseek(handler.fp, tiles & ROM_OFFSET_MASK, SEEK_SET);
 		fread(tileGfxCompressed, 1, sizeof(tileGfxCompressed), handler.fp);
-		lz77_extract(wallpaperTiles, tileGfxCompressed, sizeof(wallpaperTiles));
+		lz77_extract_bounded(wallpaperTiles, tileGfxCompressed, sizeof(wallpaperTiles),
+			sizeof(tileGfxCompressed));
 
 		// Read the compressed tile map data
 		fseek(handler.fp, tilemap & ROM_OFFSET_MASK, SEEK_SET);
 		fread(tileGfxCompressed, 1, sizeof(tileGfxCompressed), handler.fp);
-		lz77_extract(wallpaperTilemap, tileGfxCompressed, sizeof(wallpaperTilemap));
+		lz77_extract_bounded(wallpaperTilemap, tileGfxCompressed, sizeof(wallpaperTilemap),
+			sizeof(tileGfxCompressed));
 
 		// Read the palette data
 		fseek(handler.fp, pal & ROM_OFFSET_MASK, SEEK_SET);
@@ -710,7 +866,8 @@ static void dumpItemIconsRange(FILE *fout, uint16_t idx_start, uint16_t idx_end,
 			if ((tmhm_types >> cur_type & 1) != 0 && can_skip)
 				continue;
 
-			lz77_extract(tmhmPalettes + 16 * cur_type, palAddress, 32);
+			lz77_extract_bounded(tmhmPalettes + 16 * cur_type, palAddress, 32,
+				sizeof(palCompressed));
 			tmhm_types |= 1 << cur_type;
 			if (can_skip) {
 				continue;
@@ -724,10 +881,12 @@ static void dumpItemIconsRange(FILE *fout, uint16_t idx_start, uint16_t idx_end,
 
 		offsetTable[idx] = cur_offset;
 
-		if (!lz77_extract(palette, palAddress, sizeof(palette))) {
+		if (!lz77_extract_bounded(palette, palAddress, sizeof(palette),
+			sizeof(palCompressed))) {
 			memset(palette, 0, sizeof(palette));
 		}
-		if (!lz77_extract(tileGfxUncompressed, tileAddress, sizeof(tileGfxUncompressed))) {
+		if (!lz77_extract_bounded(tileGfxUncompressed, tileAddress,
+			sizeof(tileGfxUncompressed), sizeof(tileGfxCompressed))) {
 			memset(tileGfxUncompressed, 0, sizeof(tileGfxUncompressed));
 		}
 
@@ -809,7 +968,7 @@ int readFrontPalette(uint8_t *palette_out, uint16_t species, bool shiny) {
 		palAddress = palCompressed;
 	}
 
-	outlen = lz77_extract(palette_out, palAddress, 128);
+	outlen = lz77_extract_bounded(palette_out, palAddress, 128, sizeof(palCompressed));
 	if (!outlen)
 		return 0;
 
@@ -817,7 +976,7 @@ int readFrontPalette(uint8_t *palette_out, uint16_t species, bool shiny) {
 	return outlen / 32;
 }
 
-const uint8_t* readFrontImage(uint8_t *palette_out, uint16_t species,
+static const uint8_t* decodeFrontImage(uint8_t *palette_out, uint16_t species,
 	bool shiny, uint16_t gameid) {
 	const void *tileAddress;
 	int pal_res;
@@ -849,8 +1008,8 @@ const uint8_t* readFrontImage(uint8_t *palette_out, uint16_t species,
 
 		if (meta.is_compressed) {
 			fread(tileGfxCompressed, 1, MIN(meta.size, sizeof(tileGfxCompressed)), fp);
-			if (!lz77_extract(tileGfxUncompressed, tileGfxCompressed,
-				sizeof(tileGfxUncompressed))) {
+			if (!lz77_extract_bounded(tileGfxUncompressed, tileGfxCompressed,
+				sizeof(tileGfxUncompressed), MIN(meta.size, sizeof(tileGfxCompressed)))) {
 				memcpy(palette_out, unknownFrontPal, 32);
 				return (const uint8_t*) unknownFrontTiles;
 			}
@@ -863,8 +1022,8 @@ const uint8_t* readFrontImage(uint8_t *palette_out, uint16_t species,
 	pal_res = readFrontPalette(palette_out, species, shiny);
 	tileAddress = readCompressedFrontImage(species, NULL);
 
-	if (pal_res && lz77_extract(tileGfxUncompressed, tileAddress,
-		sizeof(tileGfxUncompressed))) {
+	if (pal_res && lz77_extract_bounded(tileGfxUncompressed, tileAddress,
+		sizeof(tileGfxUncompressed), sizeof(tileGfxCompressed))) {
 		tileAddress = tileGfxUncompressed;
 	}
 	else {
@@ -874,30 +1033,83 @@ const uint8_t* readFrontImage(uint8_t *palette_out, uint16_t species,
 	return tileAddress;
 }
 
-const struct BaseStatEntryGen3* getBaseStatEntry(uint16_t species, uint16_t gameid) {
-	static struct BaseStatEntryUnifiedGen3 statEntry;
-	uint8_t* tableOffset;
+static uint32_t front_cache_key(uint16_t species, bool shiny, uint16_t gameid) {
+	uint32_t source = 0;
 
-	if (gameid != 0) {
-		FILE *fp = handler.baseStatFile;
-		if (fp) {
-			fseek(fp, 24 + sizeof(statEntry) * species, SEEK_SET);
-			fread(&statEntry, sizeof(statEntry), 1, fp);
-		} else {
-			memset(&statEntry, 0, sizeof(statEntry));
+	// Like decodeFrontImage, 1 for the RSE sprite dump and 2 for FRLG's
+	if (gameid) {
+		gameid >>= 8;
+		source = 1 + (gameid == GAMEID_FIRERED || gameid == GAMEID_LEAFGREEN);
+	}
+	return 1u << 31 | source << 17 | (uint32_t) shiny << 16 | species;
+}
+
+static struct front_cache_entry* getFrontCacheEntry(uint16_t species,
+	bool shiny, uint16_t gameid) {
+	struct front_cache_entry *entry = &frontCache[0];
+	uint32_t key = front_cache_key(species, shiny, gameid);
+	uint8_t palette[128];
+
+	for (int i = 0; i < FRONT_CACHE_SLOTS; i++) {
+		if (frontCache[i].key == key) {
+			front_cache_stats.hits++;
+			frontCache[i].lastUse = ++frontCacheClock;
+			return &frontCache[i];
 		}
-		return &statEntry.entry;
+		if (frontCache[i].lastUse < entry->lastUse)
+			entry = &frontCache[i];
 	}
 
-	tableOffset = handler.baseStatTable + species * sizeof(struct BaseStatEntryGen3);
+	front_cache_stats.misses++;
+	memcpy(entry->tiles, decodeFrontImage(palette, species, shiny, gameid),
+		sizeof(entry->tiles));
+	memcpy(entry->palette, palette, sizeof(entry->palette));
+	entry->key = key;
+	entry->lastUse = ++frontCacheClock;
+	return entry;
+}
 
-	if (handler.assetSource == ASSET_SOURCE_CART) {
-		return (const struct BaseStatEntryGen3*) tableOffset;
-	} else {
-		fseek(handler.fp, (long) tableOffset & ROM_OFFSET_MASK, SEEK_SET);
-		fread(&statEntry.entry, sizeof(statEntry.entry), 1, handler.fp);
-		return &statEntry.entry;
+/**
+ * Returns the 2048 byte tiles of a 64x64 front sprite and copies its 32 byte
+ * palette into palette_out. Use gameid 0 for the active game, or any other
+ * for the sprites dumped to the SD card. The tiles stay valid until the next
+ * call.
+ */
+const uint8_t* readFrontImage(uint8_t *palette_out, uint16_t species,
+	bool shiny, uint16_t gameid) {
+	struct front_cache_entry *entry = getFrontCacheEntry(species, shiny, gameid);
+
+	memcpy(palette_out, entry->palette, sizeof(entry->palette));
+	return entry->tiles;
+}
+
+/**
+ * Decodes a front sprite into the cache ahead of time, so a later
+ * readFrontImage of it only needs a copy.
+ */
+void prefetchFrontImage(uint16_t species, bool shiny, uint16_t gameid) {
+	getFrontCacheEntry(species, shiny, gameid);
+}
+
+/**
+ * Looks up base stats in the tables loaded at init. Use gameid 0 for the
+ * active game's own table, or any other for the merged table from the SD dump.
+ * The returned pointer stays valid until the assets are reloaded, so many
+ * entries can be held at once. Unknown species get an entry of all zeroes.
+ */
+const struct BaseStatEntryGen3* getBaseStatEntry(uint16_t species, uint16_t gameid) {
+	static const struct BaseStatEntryGen3 emptyEntry;
+
+	if (species >= 440)
+		return &emptyEntry;
+	if (gameid != 0) {
+		if (!handler.baseStatsSD)
+			return &emptyEntry;
+		return &handler.baseStatsSD[species].entry;
 	}
+	if (!handler.baseStats)
+		return &emptyEntry;
+	return &handler.baseStats[species];
 }
 
 /* Generally, there are two sets of large sprites: one for Ruby/Sapphire/Emerald
@@ -943,7 +1155,8 @@ static bool write_frlg_deoxys_sprite(FILE *fp) {
 
 	tileAddress = readCompressedFrontImage(SPECIES_DEOXYS, NULL);
 	memset(tileGfxUncompressed, 0, sizeof(tileGfxUncompressed));
-	lz77_extract(tileGfxUncompressed, tileAddress, sizeof(tileGfxUncompressed));
+	lz77_extract_bounded(tileGfxUncompressed, tileAddress, sizeof(tileGfxUncompressed),
+		sizeof(tileGfxCompressed));
 	fwrite(tileGfxUncompressed + 2048, 1, 2048, fp);
 
 	return true;
@@ -976,7 +1189,8 @@ static uint32_t write_one_frontsprite(FILE *fp, int species, void **prevTiles) {
 		meta.is_compressed = 0;
 		meta.size = size = 2048 * 3;
 		memset(tileGfxUncompressed, 0, sizeof(tileGfxUncompressed));
-		lz77_extract(tileGfxUncompressed, tileAddress, sizeof(tileGfxUncompressed));
+		lz77_extract_bounded(tileGfxUncompressed, tileAddress, sizeof(tileGfxUncompressed),
+			sizeof(tileGfxCompressed));
 		if (activeGameId == GAMEID_LEAFGREEN) {
 			// Move Deoxys-Defense form from the second to third sprite
 			memcpy(tileGfxUncompressed + 4096, tileGfxUncompressed + 2048, 2048);
@@ -1046,17 +1260,18 @@ int write_frontsprites(bool force) {
 		}
 
 		fclose(handler.frontSpriteFiles[subgen]);
+		clear_front_cache();
 		fp = NULL;
 		if (IS_FIRERED_LEAFGREEN && !force) {
 			// Merge FRLG dumps
 			bool merge_success = false;
 			header.subgen_mask |= header_in.subgen_mask;
-			fp = fopen(fname, "r+b");
+			fp = sd_fopen(fname, "r+b", SD_FILE_SEQUENTIAL);
 			fwrite(&header, sizeof(header), 1, fp);
 			merge_success = write_frlg_deoxys_sprite(fp);
 			fclose(fp);
 			if (merge_success) {
-				handler.frontSpriteFiles[subgen] = fopen(fname, "rb");
+				handler.frontSpriteFiles[subgen] = sd_fopen(fname, "rb", SD_FILE_RANDOM);
 				return 1;
 			}
 			header.subgen_mask = 1 << (activeGameSubGen == GAMEID_LEAFGREEN);
@@ -1065,7 +1280,7 @@ int write_frontsprites(bool force) {
 	}
 
 	if (!fp) {
-		fp = fopen(fname, "wb");
+		fp = sd_fopen(fname, "wb", SD_FILE_SEQUENTIAL);
 		if (!fp) {
 			open_message_window("Error saving asset dump: File create failed (%d)", errno);
 			return 0;
@@ -1095,7 +1310,7 @@ int write_frontsprites(bool force) {
 
 	free(offsets);
 	fclose(fp);
-	handler.frontSpriteFiles[subgen] = fopen(fname, "rb");
+	handler.frontSpriteFiles[subgen] = sd_fopen(fname, "rb", SD_FILE_RANDOM);
 	return 1;
 }
 
@@ -1122,7 +1337,7 @@ int write_boxicons(bool force) {
 		}
 	}
 
-	fp = fopen("/pokebox/assets/boxicons03.bin", "wb");
+	fp = sd_fopen("/pokebox/assets/boxicons03.bin", "wb", SD_FILE_SEQUENTIAL);
 	if (fp < 0) {
 		open_message_window("Error saving asset dump: File create failed (%d)", errno);
 		return 0;
@@ -1152,7 +1367,8 @@ int write_boxicons(bool force) {
 	}
 
 	fclose(fp);
-	handler.iconFile = fopen("/pokebox/assets/boxicons03.bin", "rb");
+	handler.iconFile = sd_fopen("/pokebox/assets/boxicons03.bin", "rb", SD_FILE_RANDOM);
+	clear_icon_cache();
 	return 1;
 }
 
@@ -1195,7 +1411,7 @@ int write_itemicons(bool force) {
 		handler.itemIconFile = NULL;
 	}
 
-	fp = fopen("/pokebox/assets/items03.bin", "wb");
+	fp = sd_fopen("/pokebox/assets/items03.bin", "wb", SD_FILE_SEQUENTIAL);
 	if (fp < 0) {
 		open_message_window("Error saving asset dump: File create failed (%d)", errno);
 		return 0;
@@ -1216,7 +1432,7 @@ int write_itemicons(bool force) {
 
 	fclose(fp);
 	free(offsets);
-	handler.itemIconFile = fopen("/pokebox/assets/items03.bin", "rb");
+	handler.itemIconFile = sd_fopen("/pokebox/assets/items03.bin", "rb", SD_FILE_RANDOM);
 	return 1;
 }
 
@@ -1275,10 +1491,11 @@ int write_basestats(bool force) {
 
 		header.subgen_mask |= header_in.subgen_mask;
 
-		fp = freopen("/pokebox/assets/basestats03.bin", "r+b", handler.baseStatFile);
+		fp = sd_freopen("/pokebox/assets/basestats03.bin", "r+b", handler.baseStatFile,
+			SD_FILE_SEQUENTIAL);
 		fseek(fp, 0, SEEK_SET);
 	} else {
-		fp = fopen("/pokebox/assets/basestats03.bin", "wb");
+		fp = sd_fopen("/pokebox/assets/basestats03.bin", "wb", SD_FILE_SEQUENTIAL);
 		if (fp < 0) {
 			open_message_window("Error saving asset dump: File create failed (%d)", errno);
 			return 0;
@@ -1291,7 +1508,10 @@ int write_basestats(bool force) {
 	for (int i = 0; i < 440; i++) {
 		const struct BaseStatEntryGen3 *stats_in;
 		stats_in = getBaseStatEntry(i, 0);
-		if (handler.baseStatFile) {
+		if (handler.baseStatsSD) {
+			// Merge from the copy in RAM so the file is only written front to back
+			stats = handler.baseStatsSD[i];
+		} else if (handler.baseStatFile) {
 			fread(&stats, 1, sizeof(stats), fp);
 			fseek(fp, -sizeof(stats), SEEK_CUR);
 		} else {
@@ -1303,7 +1523,8 @@ int write_basestats(bool force) {
 	}
 
 	fclose(fp);
-	handler.baseStatFile = fopen("/pokebox/assets/basestats03.bin", "rb");
+	handler.baseStatFile = sd_fopen("/pokebox/assets/basestats03.bin", "rb", SD_FILE_RANDOM);
+	load_basestats_sd();
 	return 1;
 }
 
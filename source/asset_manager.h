@@ -23,6 +23,18 @@
 
 #include "languages.h"
 
+struct icon_cache_stats {
+	uint32_t hits;
+	uint32_t misses;
+};
+
+struct front_cache_stats {
+	uint32_t hits;
+	uint32_t misses;
+};
+
+extern struct icon_cache_stats icon_cache_stats;
+extern struct front_cache_stats front_cache_stats;
 extern uint8_t wallpaperTiles[0x1000];
 extern uint16_t wallpaperTilemap[0x2d0];
 extern uint16_t wallpaperPal[16 * 4];
@@ -78,6 +90,8 @@ uint8_t getIconPaletteIdx(uint16_t species);
 const uint16_t* getIconImage(uint16_t species);
 const uint16_t* getIconPaletteColors(int index);
 const uint8_t* readFrontImage(uint8_t *palette_out, uint16_t species, _Bool shiny, uint16_t gameid);
+void prefetchFrontImage(uint16_t species, _Bool shiny, uint16_t gameid);
 bool loadItemIcon(uint8_t *tiles_out, uint8_t *palette_out, uint16_t item_idx);
 int loadWallpaper(int index);
+// Returned pointer stays valid until the assets are reloaded
 const struct BaseStatEntryGen3* getBaseStatEntry(uint16_t species, uint16_t gameid);
@@ -0,0 +1,195 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "box_cache.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "message_window.h"
+#include "pkmx_format.h"
+#include "sd_boxes.h"
+
+/* Keeps a few boxes of an SD group in memory instead of the whole group, so
+ * groups can have up to 255 boxes. Boxes are paged in from sd_boxes when
+ * they're needed, and the least recently used one makes room.
+ *
+ * Changed boxes that get evicted are written back to their staging copy in
+ * the group file. They aren't saved for real until box_cache_save, so
+ * quitting without saving still throws away every change.
+ */
+
+// Enough for both boxes of a move plus some back-and-forth browsing
+#define BOX_CACHE_SLOTS 8
+#define NO_BOX 0xFFFF
+
+struct box_cache_slot {
+	uint16_t boxIdx;
+	uint8_t dirty;
+	uint8_t unused;
+	uint32_t lastUse;
+};
+
+struct box_cache_stats box_cache_stats;
+
+static struct box_cache_slot slots[BOX_CACHE_SLOTS];
+static uint8_t *slot_data = NULL;
+static uint32_t use_clock;
+static uint16_t num_boxes;
+
+static inline uint8_t* slot_box(int slotIdx) {
+	return slot_data + slotIdx * BOX_SIZE_BYTES_X;
+}
+
+static int find_slot(uint16_t boxIdx) {
+	for (int i = 0; i < BOX_CACHE_SLOTS; i++) {
+		if (slots[i].boxIdx == boxIdx)
+			return i;
+	}
+	return -1;
+}
+
+static int write_back(int slotIdx) {
+	if (!slots[slotIdx].dirty)
+		return 1;
+	if (!sd_boxes_write_box(slot_box(slotIdx), slots[slotIdx].boxIdx))
+		return 0;
+	slots[slotIdx].dirty = 0;
+	return 1;
+}
+
+/**
+ * Opens an SD box group. Only BOX_CACHE_SLOTS boxes are kept in memory.
+ */
+int box_cache_open(uint8_t group, uint16_t *numBoxes_out) {
+	box_cache_close();
+	if (!slot_data)
+		slot_data = malloc(BOX_CACHE_SLOTS * BOX_SIZE_BYTES_X);
+	if (!slot_data) {
+		open_message_window("Error loading SD boxes: Out of memory");
+		return 0;
+	}
+	for (int i = 0; i < BOX_CACHE_SLOTS; i++) {
+		slots[i].boxIdx = NO_BOX;
+		slots[i].dirty = 0;
+		slots[i].lastUse = 0;
+	}
+	use_clock = 0;
+	memset(&box_cache_stats, 0, sizeof(box_cache_stats));
+	if (!sd_boxes_open(group, &num_boxes)) {
+		box_cache_close();
+		return 0;
+	}
+	*numBoxes_out = num_boxes;
+	return 1;
+}
+
+/**
+ * Returns the 30 PKMX of a box, or NULL if it can't be read.
+ * The result stays valid until a different box is requested more than
+ * BOX_CACHE_SLOTS - 1 times, so two boxes can be worked on at once.
+ */
+uint8_t* box_cache_get(uint16_t boxIdx) {
+	int slotIdx;
+	int rc;
+
+	if (!slot_data || boxIdx >= num_boxes)
+		return NULL;
+
+	slotIdx = find_slot(boxIdx);
+	if (slotIdx >= 0) {
+		box_cache_stats.hits++;
+		slots[slotIdx].lastUse = ++use_clock;
+		return slot_box(slotIdx);
+	}
+
+	// Use a free slot if there is one, otherwise the least recently used
+	slotIdx = 0;
+	for (int i = 0; i < BOX_CACHE_SLOTS; i++) {
+		if (slots[i].boxIdx == NO_BOX) {
+			slotIdx = i;
+			break;
+		}
+		if (slots[i].lastUse < slots[slotIdx].lastUse)
+			slotIdx = i;
+	}
+	if (slots[slotIdx].dirty) {
+		if (!write_back(slotIdx))
+			return NULL;
+		box_cache_stats.writeBacks++;
+	}
+
+	box_cache_stats.misses++;
+	slots[slotIdx].boxIdx = NO_BOX;
+	rc = sd_boxes_read_box(slot_box(slotIdx), boxIdx);
+	if (!rc)
+		return NULL;
+	slots[slotIdx].boxIdx = boxIdx;
+	// A box read from an older copy has to be written again to repair it
+	slots[slotIdx].dirty = rc == 2;
+	slots[slotIdx].lastUse = ++use_clock;
+	return slot_box(slotIdx);
+}
+
+/**
+ * Records that a box returned by box_cache_get was changed.
+ */
+void box_cache_mark_dirty(uint16_t boxIdx) {
+	int slotIdx = find_slot(boxIdx);
+	if (slotIdx >= 0)
+		slots[slotIdx].dirty = 1;
+}
+
+/**
+ * Returns whether a box changed since the group was last saved, so the
+ * group's search index doesn't describe it anymore.
+ */
+int box_cache_box_changed(uint16_t boxIdx) {
+	int slotIdx = find_slot(boxIdx);
+
+	if (slotIdx >= 0 && slots[slotIdx].dirty)
+		return 1;
+	return sd_boxes_box_staged(boxIdx);
+}
+
+/**
+ * Writes every changed box and commits them to the group file.
+ */
+int box_cache_save(void) {
+	for (int i = 0; i < BOX_CACHE_SLOTS; i++) {
+		if (slots[i].boxIdx != NO_BOX && !write_back(i))
+			return 0;
+	}
+	return sd_boxes_commit(num_boxes);
+}
+
+/**
+ * Closes the group and frees the cache. Changes that weren't saved are lost.
+ */
+void box_cache_close(void) {
+	sd_boxes_close();
+	free(slot_data);
+	slot_data = NULL;
+	num_boxes = 0;
+	for (int i = 0; i < BOX_CACHE_SLOTS; i++)
+		slots[i].boxIdx = NO_BOX;
+}
+
+uint32_t box_cache_resident_bytes(void) {
+	return BOX_CACHE_SLOTS * BOX_SIZE_BYTES_X;
+}
@@ -0,0 +1,36 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+
+struct box_cache_stats {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t writeBacks; // Dirty boxes staged to the SD card to make room
+};
+
+extern struct box_cache_stats box_cache_stats;
+
+int box_cache_open(uint8_t group, uint16_t *numBoxes_out);
+uint8_t* box_cache_get(uint16_t boxIdx);
+void box_cache_mark_dirty(uint16_t boxIdx);
+int box_cache_box_changed(uint16_t boxIdx);
+int box_cache_save(void);
+void box_cache_close(void);
+uint32_t box_cache_resident_bytes(void);
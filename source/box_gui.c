@@ -26,13 +26,16 @@
 #include "cursor.h"
 #include "defWallpapers.h"
 #include "boxesTileset.h"
+#include "box_cache.h"
+#include "box_sort.h"
 #include "gui_util.h"
+#include "icon_atlas.h"
 #include "message_window.h"
+#include "pkm_dupes.h"
 #include "pkmx_format.h"
 #include "pokemon_strings.h"
 #include "savedata_gen3.h"
 #include "string_gen3.h"
-#include "sd_boxes.h"
 #include "text_draw.h"
 #include "utf8.h"
 
@@ -49,6 +52,19 @@
 #include "sidePaneButtonSelect_map.h"
 
 static int activeSprite = 0;
+// Bottom screen sprites holding a reference to a slot of the icon atlas
+static bool iconSpriteAcquired[SPRITE_COUNT];
+
+/* Box icons animate by pointing their sprites at the other of the two
+ * frames in the icon atlas, which costs one OAM write per icon instead of
+ * uploading 1 KB of tiles. If a previous frame's animation took longer than
+ * the budget, only the hovered or held icons keep animating.
+ */
+#define ICON_ANIM_PERIOD 16 // Frames per icon animation frame
+#define ICON_ANIM_BUDGET_TICKS (BUS_CLOCK / 60 / 100) // 1% of a frame
+static uint8_t iconAnimFrame;
+static uint8_t iconAnimTimer;
+static uint32_t iconAnimTicks; // Duration of the last animation step
 
 #define GUI_FLAG_SELECTING 0x01
 #define GUI_FLAG_HOLDING 0x02
@@ -104,7 +120,7 @@ typedef union box_icon {
 
 struct boxgui_groupView {
 	uint8_t groupIdx;
-	int8_t activeBox;
+	uint8_t activeBox;
 	uint8_t numBoxes;
 	uint8_t unused_1;
 	union {
@@ -119,8 +135,9 @@ struct boxgui_groupView {
 	uint16_t boxSizeBytes;
 	uint16_t **boxNames;
 	uint8_t *boxWallpapers;
-	uint8_t *boxData;
+	uint8_t *boxData; // NULL for SD groups, which go through box_cache
 	box_icon_t *boxIcons;
+	uint8_t *iconsDecoded; // One bit per box
 };
 
 struct boxgui_state {
@@ -130,7 +147,7 @@ struct boxgui_state {
 	uint8_t cursorMode; //TODO
 	struct boxgui_groupView topScreen;
 	struct boxgui_groupView botScreen;
-	int8_t holdingSourceBox;
+	uint8_t holdingSourceBox;
 	uint8_t holdingSourceGroup;
 	int8_t holdingSource_x;
 	int8_t holdingSource_y;
@@ -138,12 +155,15 @@ struct boxgui_state {
 	int8_t holdingMax_x;
 	int8_t holdingMin_y;
 	int8_t holdingMax_y;
-	box_icon_t boxIcons1[32 * 30];
-	box_icon_t boxIcons2[32 * 30];
+	uint8_t prefetchStep; // Next neighbor of the cursor to prefetch
+	box_icon_t boxIcons1[14 * 30];
+	box_icon_t boxIcons2[255 * 30];
+	uint8_t iconsDecoded1[(14 + 7) / 8];
+	uint8_t iconsDecoded2[(255 + 7) / 8];
 	box_icon_t holdIcons[30];
-	uint8_t hoverPkm[PKMX_SIZE];
-	uint8_t boxData1[32 * BOX_SIZE_BYTES_X];
-	uint8_t boxData2[32 * BOX_SIZE_BYTES_X];
+	// The PKM decoder reads these as 32-bit words
+	uint8_t hoverPkm[PKMX_SIZE] __attribute__((aligned(4)));
+	uint8_t boxData1[14 * BOX_SIZE_BYTES_3] __attribute__((aligned(4)));
 };
 
 static void draw_builtin_wallpaper(const tilemap_t *tilemap, uint8_t screen, uint8_t x, uint8_t y) {
@@ -363,38 +383,78 @@ static void load_cursor() {
 	dmaCopy(cursorPal, SPRITE_PALETTE_SUB + 16 * 8, sizeof(cursorPal));
 }
 
+static void hide_icon_sprite(int oamIndex) {
+	SpriteEntry *oam = &oamSub.oamMemory[oamIndex];
+
+	if (iconSpriteAcquired[oamIndex]) {
+		icon_atlas_release(oam->gfxIndex);
+		iconSpriteAcquired[oamIndex] = false;
+	}
+	oam->attribute[0] = 0;
+	oam->attribute[1] = 0;
+	oam->attribute[2] = 0;
+}
+
 static int display_icon_sprites(
-	const box_icon_t *iconList, int oamIndex, int gfxIndex, int x, int y) {
+	const box_icon_t *iconList, int oamIndex, int x, int y) {
 
 	int obj_idx = 0;
 
 	for (int i = 0; i < 30; i++) {
 		box_icon_t icon = iconList[i];
 		SpriteEntry *oam = &oamSub.oamMemory[oamIndex + i];
+		uint16_t gfxIndex;
 
-		if (icon.species == 0) {
-			oam->attribute[0] = 0;
-			oam->attribute[1] = 0;
-			oam->attribute[2] = 0;
+		// Acquire before releasing, so an unchanged icon keeps its tiles
+		gfxIndex = icon.species ? icon_atlas_acquire(icon.value) : ICON_ATLAS_FULL;
+		hide_icon_sprite(oamIndex + i);
+		if (gfxIndex == ICON_ATLAS_FULL)
 			continue;
-		}
 
+		iconSpriteAcquired[oamIndex + i] = true;
 		oam->attribute[0] = OBJ_Y((i / 6) * 24 + y) | ATTR0_COLOR_16;
 		oam->attribute[1] = OBJ_X((i % 6) * 24 + x) | ATTR1_SIZE_32;
 		oam->palette = getIconPaletteIdx(icon.value);
-		oam->gfxIndex = gfxIndex + i * 8;
-		// Each 32x32@4bpp sprite is 512 bytes.
-		// 2 animation frames at 512 bytes each = 1024 bytes per Pokemon.
-		dmaCopy(
-			getIconImage(icon.value),
-			(uint8_t*) SPRITE_GFX_SUB + gfxIndex * 128 + i * 1024,
-			1024);
+		// The second animation frame is 512 bytes (4 gfx units) later
+		oam->gfxIndex = gfxIndex + iconAnimFrame * 4;
 
 		obj_idx++;
 	}
 	return obj_idx;
 }
 
+static void set_icon_frame(int oamIndex) {
+	SpriteEntry *oam = &oamSub.oamMemory[oamIndex];
+
+	if (iconSpriteAcquired[oamIndex])
+		oam->gfxIndex = (oam->gfxIndex & ~4) | (iconAnimFrame * 4);
+}
+
+/**
+ * Advances the box icon animation. This is called once per VBlank and only
+ * writes to the OAM copy that oamUpdate uploads.
+ */
+static void animate_icon_sprites(const struct boxgui_state *guistate) {
+	int hoverOnly;
+
+	if (++iconAnimTimer < ICON_ANIM_PERIOD)
+		return;
+	iconAnimTimer = 0;
+	iconAnimFrame ^= 1;
+	hoverOnly = iconAnimTicks > ICON_ANIM_BUDGET_TICKS;
+
+	cpuStartTiming(2);
+	for (int i = 0; i < 30; i++)
+		set_icon_frame(OAM_INDEX_HOLDING + i);
+	if (!hoverOnly) {
+		for (int i = 0; i < 30; i++)
+			set_icon_frame(OAM_INDEX_CURBOX + i);
+	} else if ((guistate->flags & GUI_FLAG_HOLDING) == 0) {
+		set_icon_frame(OAM_INDEX_CURBOX + guistate->cursor_y * 6 + guistate->cursor_x);
+	}
+	iconAnimTicks = cpuEndTiming();
+}
+
 static void move_icon_sprites(int oamIndex, int x, int y) {
 	for (int i = 0; i < 30; i++) {
 		SpriteEntry *oam = &oamSub.oamMemory[oamIndex + i];
@@ -408,12 +468,8 @@ static void move_icon_sprites(int oamIndex, int x, int y) {
 }
 
 static void clear_icon_sprites(int oamIndex) {
-	for (int i = 0; i < 30; i++) {
-		SpriteEntry *oam = &oamSub.oamMemory[oamIndex + i];
-		oam->attribute[0] = 0;
-		oam->attribute[1] = 0;
-		oam->attribute[2] = 0;
-	}
+	for (int i = 0; i < 30; i++)
+		hide_icon_sprite(oamIndex + i);
 }
 
 static void clear_selection_shadow() {
@@ -424,39 +480,71 @@ static void clear_selection_shadow() {
 	}
 }
 
-static void decode_boxes(struct boxgui_groupView *group) {
-	uint16_t checksum;
+/**
+ * Returns the Pokemon data of a box, or NULL if it couldn't be loaded.
+ * SD boxes are paged in, so only the two most recently used stay valid.
+ */
+static uint8_t* group_box_data(const struct boxgui_groupView *group, uint8_t boxIdx) {
+	if (group->boxData)
+		return group->boxData + boxIdx * group->boxSizeBytes;
+	return box_cache_get(boxIdx);
+}
+
+static void decode_box(struct boxgui_groupView *group, uint8_t boxIdx) {
+	uint16_t checksums[30];
 	box_icon_t icon;
-	pkm3_t pkm;
-	for (int pkmIdx = 0; pkmIdx < 30 * group->numBoxes; pkmIdx++) {
+	pkm3_t pkms[30];
+	const uint8_t *boxBytes = group_box_data(group, boxIdx);
+	box_icon_t *boxIcons = group->boxIcons + boxIdx * 30;
+
+	if (!boxBytes)
+		return;
+
+	// Cartridge boxes only hold Gen3 data, so decode the whole box at once
+	if (group->generation == 3)
+		decode_pkm_batch(pkms, checksums, boxBytes, group->pkmSize, 30);
+
+	for (int pkmIdx = 0; pkmIdx < 30; pkmIdx++) {
 		const uint8_t *bytes;
 		int generation;
-		bytes = group->boxData + pkmIdx * group->pkmSize;
+		bytes = boxBytes + pkmIdx * group->pkmSize;
 		generation = group->generation;
 		if (generation == 0) {
 			generation = bytes[0];
 			bytes += 4;
 			if (generation == 0) {
 				// Blank space
-				group->boxIcons[pkmIdx].value = 0;
+				boxIcons[pkmIdx].value = 0;
 				continue;
 			}
+			if (generation == 3)
+				checksums[pkmIdx] = decode_pkm_encrypted_data(&pkms[pkmIdx], bytes);
 		}
 		if (generation != 3) {
 			// Question mark for other generations we can't decode yet
 			icon.species = 252;
 			icon.generation = 3;
-			group->boxIcons[pkmIdx] = icon;
+			boxIcons[pkmIdx] = icon;
 			continue;
 		}
-		checksum = decode_pkm_encrypted_data(&pkm, bytes);
-		if (checksum != pkm.checksum)
+		if (checksums[pkmIdx] != pkms[pkmIdx].checksum)
 			icon.species = 412; // Egg icon for Bad EGG
 		else
-			icon.species = pkm_displayed_species(&pkm);
+			icon.species = pkm_displayed_species(&pkms[pkmIdx]);
 		icon.generation = group->gameId ? 0 : 3;
-		group->boxIcons[pkmIdx] = icon;
+		boxIcons[pkmIdx] = icon;
 	}
+	group->iconsDecoded[boxIdx / 8] |= 1 << (boxIdx & 7);
+}
+
+/**
+ * Returns the icons of a box, decoding them the first time the box is shown.
+ * After that they also track Pokemon that are picked up, so they're kept.
+ */
+static box_icon_t* group_box_icons(struct boxgui_groupView *group, uint8_t boxIdx) {
+	if (!(group->iconsDecoded[boxIdx / 8] & (1 << (boxIdx & 7))))
+		decode_box(group, boxIdx);
+	return group->boxIcons + boxIdx * 30;
 }
 
 static void update_cursor(struct boxgui_state *guistate) {
@@ -465,6 +553,7 @@ static void update_cursor(struct boxgui_state *guistate) {
 	int icons_x, icons_y;
 
 	group = &guistate->botScreen;
+	guistate->prefetchStep = 0;
 
 	if (group->generation == 3) {
 		oamSub.oamMemory[0].x = guistate->cursor_x * 24 + 12;
@@ -483,11 +572,13 @@ static void update_cursor(struct boxgui_state *guistate) {
 		status_display_update(guistate->hoverPkm,
 			(guistate->flags & GUI_FLAG_HOVER_IS_CART) != 0);
 	} else {
-		pkm_to_pkmx(guistate->hoverPkm,
-			guistate->botScreen.boxData +
-			guistate->botScreen.activeBox * guistate->botScreen.boxSizeBytes +
-			cur_poke * guistate->botScreen.pkmSize,
-			guistate->botScreen.gameId);
+		const uint8_t *boxBytes = group_box_data(group, group->activeBox);
+		if (boxBytes) {
+			pkm_to_pkmx(guistate->hoverPkm, boxBytes + cur_poke * group->pkmSize,
+				group->gameId);
+		} else {
+			memset(guistate->hoverPkm, 0, PKMX_SIZE);
+		}
 		guistate->flags &= ~GUI_FLAG_HOVER_IS_CART;
 		if (guistate->botScreen.gameId)
 			guistate->flags |= GUI_FLAG_HOVER_IS_CART;
@@ -516,10 +607,10 @@ static void update_cursor(struct boxgui_state *guistate) {
 	}
 }
 
-static int display_box(const struct boxgui_state *guistate) {
+static int display_box(struct boxgui_state *guistate) {
 	uint16_t *name;
 	int rc;
-	const struct boxgui_groupView *group;
+	struct boxgui_groupView *group;
 	char namebuf[20];
 	const textLabel_t *nameLabel;
 
@@ -607,12 +698,42 @@ static int display_box(const struct boxgui_state *guistate) {
 	}
 
 	rc = display_icon_sprites(
-		group->boxIcons + group->activeBox * 30,
-		OAM_INDEX_CURBOX, OBJ_GFXIDX_CURBOX,
-		icons_x, icons_y);
+		group_box_icons(group, group->activeBox),
+		OAM_INDEX_CURBOX, icons_x, icons_y);
 	return rc;
 }
 
+/**
+ * Decodes the front sprite of one of the slots next to the cursor, so
+ * moving there only has to copy it from the cache. This is called on
+ * frames without input and does one slot per frame.
+ */
+static void prefetch_neighbors(struct boxgui_state *guistate) {
+	static const int8_t offsets[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+	uint8_t pkmx[PKMX_SIZE] __attribute__((aligned(4)));
+	const struct boxgui_groupView *group = &guistate->botScreen;
+	struct SimplePKM pkm;
+	const uint8_t *boxBytes;
+	int x, y;
+
+	if (guistate->prefetchStep >= ARRAY_LENGTH(offsets) ||
+		(guistate->flags & GUI_FLAG_HOLDING))
+		return;
+	x = guistate->cursor_x + offsets[guistate->prefetchStep][0];
+	y = guistate->cursor_y + offsets[guistate->prefetchStep][1];
+	guistate->prefetchStep++;
+	if (x < 0 || x >= 6 || y < 0 || y >= 5)
+		return;
+
+	boxBytes = group_box_data(group, group->activeBox);
+	if (!boxBytes)
+		return;
+	pkm_to_pkmx(pkmx, boxBytes + (y * 6 + x) * group->pkmSize, group->gameId);
+	pkmx_to_simplepkm(&pkm, pkmx, group->gameId != 0);
+	if (pkm.exists)
+		prefetchFrontImage(pkm.spriteIdx, pkm.isShiny, pkm.isOnCart ? 0 : pkm.curGameId);
+}
+
 static int switch_box(struct boxgui_state *guistate, int rel) {
 	struct boxgui_groupView *group;
 	int activeBox;
@@ -743,7 +864,7 @@ static void pickup_selection(struct boxgui_state *guistate) {
 	int dy = guistate->holdingMin_y;
 	int icons_x, icons_y;
 	struct boxgui_groupView *group = &guistate->botScreen;
-	box_icon_t *curBoxIcons = group->boxIcons + 30 * group->activeBox;
+	box_icon_t *curBoxIcons = group_box_icons(group, group->activeBox);
 	int isPopulated = 0;
 
 	if (width * height > 1)
@@ -778,8 +899,7 @@ static void pickup_selection(struct boxgui_state *guistate) {
 	}
 
 	display_icon_sprites(
-		guistate->holdIcons, OAM_INDEX_HOLDING, OBJ_GFXIDX_HOLDING,
-		icons_x, icons_y);
+		guistate->holdIcons, OAM_INDEX_HOLDING, icons_x, icons_y);
 	display_box(guistate);
 	update_cursor(guistate);
 }
@@ -796,7 +916,7 @@ static void drop_holding(struct boxgui_state *guistate) {
 
 	if (group->groupIdx != guistate->holdingSourceGroup)
 		srcGroup = &guistate->topScreen;
-	srcBoxIcons = srcGroup->boxIcons + 30 * guistate->holdingSourceBox;
+	srcBoxIcons = group_box_icons(srcGroup, guistate->holdingSourceBox);
 
 	for (int y = 0; y < height; y++) {
 		for (int x = 0; x < width; x++) {
@@ -833,10 +953,13 @@ static void store_holding(struct boxgui_state *guistate) {
 	} else {
 		srcGroup = &guistate->topScreen;
 	}
-	dstBoxIcons = dstGroup->boxIcons + dstGroup->activeBox * 30;
-	srcBoxIcons = srcGroup->boxIcons + guistate->holdingSourceBox * 30;
-	dstBoxData = dstGroup->boxData + dstGroup->activeBox * dstGroup->boxSizeBytes;
-	srcBoxData = srcGroup->boxData + guistate->holdingSourceBox * srcGroup->boxSizeBytes;
+	dstBoxIcons = group_box_icons(dstGroup, dstGroup->activeBox);
+	srcBoxIcons = group_box_icons(srcGroup, guistate->holdingSourceBox);
+	// Fetched last so both boxes stay in the SD box cache
+	dstBoxData = group_box_data(dstGroup, dstGroup->activeBox);
+	srcBoxData = group_box_data(srcGroup, guistate->holdingSourceBox);
+	if (!dstBoxData || !srcBoxData)
+		return;
 
 	if (guistate->flags & GUI_FLAG_HOLDING_MULTIPLE) {
 		// Do nothing if any spot in the destination is occupied.
@@ -904,18 +1027,28 @@ static void store_holding(struct boxgui_state *guistate) {
 
 			// TODO Save any lost-in-conversion data when depositing to a game
 			// ...after implementing any actual generation conversions
+			if (srcGroup->gameId)
+				pokedex_track_pkm(srcPkm, -1);
+			if (dstGroup->gameId)
+				pokedex_track_pkm(dstPkm, -1);
 			pkmx_to_pkm(dstPkm, tmpPkm1, dstGroup->generation);
 			pkmx_to_pkm(srcPkm, tmpPkm2, srcGroup->generation);
+			if (srcGroup->gameId)
+				pokedex_track_pkm(srcPkm, 1);
+			if (dstGroup->gameId)
+				pokedex_track_pkm(dstPkm, 1);
 
 			// Clear this Pokemon from the holding list
 			guistate->holdIcons[y * 6 + x].value = 0;
-			SpriteEntry *oam = &oamSub.oamMemory[OAM_INDEX_HOLDING + y * 6 + x];
-			oam->attribute[0] = 0;
-			oam->attribute[1] = 0;
-			oam->attribute[2] = 0;
+			hide_icon_sprite(OAM_INDEX_HOLDING + y * 6 + x);
 		}
 	}
 
+	if (!srcGroup->boxData)
+		box_cache_mark_dirty(guistate->holdingSourceBox);
+	if (!dstGroup->boxData)
+		box_cache_mark_dirty(dstGroup->activeBox);
+
 	int isStillHolding = 0;
 	for (int i = 0; i < 30; i++) {
 		if (guistate->holdIcons[i].species) {
@@ -992,18 +1125,87 @@ int open_context_menu(struct boxgui_state *guistate, const char *const *opts, in
 
 static int save_boxes(struct boxgui_state *guistate) {
 	write_boxes_savedata(guistate->boxData1);
-	if (!sd_boxes_save(guistate->boxData2, 0, 32))
+	if (!box_cache_save())
 		return 0;
 	if (!write_savedata())
 		return 0;
 	return 1;
 }
 
+/**
+ * Asks for a sort key and sorts every box of the group on the bottom screen.
+ */
+static void sort_group(struct boxgui_state *guistate) {
+	const char *opts[] = {"Dex No.", "Level", "OT ID", "Shiny", "Stats", "Back"};
+	struct boxgui_groupView *group = &guistate->botScreen;
+	int selected;
+	int rc;
+
+	selected = open_context_menu(guistate, opts, ARRAY_LENGTH(opts));
+	if (selected < 0 || selected >= BOX_SORT_KEY_COUNT)
+		return;
+	if (group->boxData)
+		rc = box_sort_records(group->boxData, group->numBoxes * 30, group->gameId, selected);
+	else
+		rc = box_sort_cache(0, group->numBoxes, selected);
+	if (rc == BOX_SORT_NO_MEMORY)
+		open_message_window("Not enough memory to sort boxes");
+	else if (rc == BOX_SORT_READ_ERROR)
+		open_message_window("Error reading boxes from SD card");
+	else if (rc == BOX_SORT_WRITE_ERROR)
+		open_message_window("Error writing to SD card");
+
+	memset(group->iconsDecoded, 0, (group->numBoxes + 7) / 8);
+}
+
+/**
+ * Lists a few Pokemon that are stored more than once, like after a save that
+ * failed halfway or restoring a backup of the SD card. SD groups are checked
+ * as of their last save, which can mean rebuilding their search indexes.
+ */
+static void show_duplicates(struct boxgui_state *guistate) {
+	const struct boxgui_groupView *cart = &guistate->botScreen;
+	const struct boxgui_groupView *sd = &guistate->topScreen;
+	struct pkm_dupe dupes[6];
+	char msg[320];
+	int len, numDupes;
+
+	if (!cart->gameId) {
+		cart = &guistate->topScreen;
+		sd = &guistate->botScreen;
+	}
+	// The SD group's unsaved changes come from the box cache
+	numDupes = find_duplicates(cart->boxData, cart->numBoxes * 30, cart->gameId,
+		sd->groupIdx, sd->numBoxes, dupes, ARRAY_LENGTH(dupes));
+	if (numDupes < 0) {
+		open_message_window("Not enough memory to search for duplicates");
+		return;
+	} else if (numDupes == 0) {
+		open_message_window("No Pokemon are stored more than once");
+		return;
+	}
+	len = snprintf(msg, sizeof(msg), "Some Pokemon are stored more\nthan once:\n");
+	for (int i = 0; i < numDupes && len < sizeof(msg); i++) {
+		const struct pkm_dupe *dupe = &dupes[i];
+		if (i > 0 && dupe->set != dupes[i - 1].set)
+			len += snprintf(msg + len, sizeof(msg) - len, "\n");
+		if (dupe->group == DUPES_GROUP_CART) {
+			len += snprintf(msg + len, sizeof(msg) - len, "Cart box %d, slot %d\n",
+				dupe->box + 1, dupe->slot + 1);
+		} else {
+			len += snprintf(msg + len, sizeof(msg) - len, "SD group %d box %d, slot %d\n",
+				dupe->group + 1, dupe->box + 1, dupe->slot + 1);
+		}
+	}
+	open_message_window("%s", msg);
+}
+
 void open_boxes_gui() {
 	struct boxgui_state *guistate;
 	const int NUM_BOXES = 14;
 	uint16_t box_name_buffer[9 * NUM_BOXES];
 	uint16_t *box_names[NUM_BOXES];
+	uint16_t sdNumBoxes;
 
 	sysSetBusOwners(true, true);
 	swiDelay(10);
@@ -1036,22 +1238,27 @@ void open_boxes_gui() {
 	guistate->botScreen.activeBox = load_boxes_savedata(guistate->boxData1);
 	guistate->botScreen.boxData = guistate->boxData1;
 	guistate->botScreen.boxIcons = guistate->boxIcons1;
+	guistate->botScreen.iconsDecoded = guistate->iconsDecoded1;
 	guistate->topScreen.groupIdx = 0;
 	guistate->topScreen.gameId = 0;
-	guistate->topScreen.numBoxes = 32;
-	guistate->topScreen.boxData = guistate->boxData2;
+	guistate->topScreen.boxData = NULL;
 	guistate->topScreen.boxIcons = guistate->boxIcons2;
+	guistate->topScreen.iconsDecoded = guistate->iconsDecoded2;
 	guistate->topScreen.pkmSize = PKMX_SIZE;
 	guistate->topScreen.boxSizeBytes = PKMX_SIZE * 30;
 
-	if (!sd_boxes_load(guistate->topScreen.boxData, 0, &guistate->topScreen.numBoxes)) {
+	if (!box_cache_open(0, &sdNumBoxes)) {
 		open_message_window("Error loading from SD card");
 		free(guistate);
 		return;
 	}
+	guistate->topScreen.numBoxes = sdNumBoxes;
 
 	oamInit(&oamMain, SpriteMapping_1D_128, false);
 	oamInit(&oamSub, SpriteMapping_1D_128, false);
+	icon_atlas_reset();
+	memset(iconSpriteAcquired, 0, sizeof(iconSpriteAcquired));
+	iconAnimTicks = 0;
 
 	// Load all Pokemon box icon palettes into VRAM
 	dmaCopy(getIconPaletteColors(0), (uint8_t*) SPRITE_PALETTE, 32 * 6);
@@ -1061,8 +1268,6 @@ void open_boxes_gui() {
 	load_cursor();
 	resetTextLabels(0);
 	resetTextLabels(1);
-	decode_boxes(&guistate->botScreen);
-	decode_boxes(&guistate->topScreen);
 	display_box(guistate);
 	update_cursor(guistate);
 	oamUpdate(&oamMain);
@@ -1085,7 +1290,7 @@ void open_boxes_gui() {
 			if (guistate->flags & GUI_FLAG_HOLDING) {
 				drop_holding(guistate);
 			} else {
-				const char *opts[] = {"Save+Quit", "Quit", "Back"};
+				const char *opts[] = {"Save+Quit", "Quit", "Sort", "Dupes", "Back"};
 				int selected = -1;
 				selected = open_context_menu(guistate, opts, ARRAY_LENGTH(opts));
 				if (selected == 0) {
@@ -1095,6 +1300,13 @@ void open_boxes_gui() {
 					update_cursor(guistate);
 				} else if (selected == 1) {
 					break;
+				} else if (selected == 2) {
+					sort_group(guistate);
+					display_box(guistate);
+					update_cursor(guistate);
+				} else if (selected == 3) {
+					show_duplicates(guistate);
+					update_cursor(guistate);
 				} else {
 					update_cursor(guistate);
 				}
@@ -1116,6 +1328,9 @@ void open_boxes_gui() {
 			if ((guistate->flags & GUI_FLAG_SELECTING) == 0)
 				switch_box(guistate, (keys & KEY_L) ? -1 : 1);
 		}
+		if (keysHeld() == 0)
+			prefetch_neighbors(guistate);
+		animate_icon_sprites(guistate);
 		oamUpdate(&oamMain);
 		oamUpdate(&oamSub);
 	}
@@ -1128,6 +1343,7 @@ void open_boxes_gui() {
 	oamDisable(&oamSub);
 	clearConsoles();
 	selectTopConsole();
+	box_cache_close();
 	free(guistate);
 	clearConsoles();
 }
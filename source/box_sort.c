@@ -0,0 +1,231 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "box_sort.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "box_cache.h"
+#include "pkmx_format.h"
+#include "savedata_gen3.h"
+#include "sd_boxes.h"
+#include "sd_file.h"
+#include "sd_groups.h"
+
+#define SORT_BOX_BYTES (30 * PKMX_SIZE)
+#define SORT_SNAPSHOT_PATH SD_BOXES_DIR "/sort.tmp"
+
+/* Sorting takes three passes over the records: one to decode each slot once
+ * into a sort_entry, a qsort of the small entries, and one to move every
+ * record straight to its new place by following the cycles of the
+ * permutation. Moving along a cycle only needs room for one record, so the
+ * records never have to be copied to a second buffer.
+ *
+ * Empty slots always go last, so sorting also packs the Pokemon together.
+ * Slots with equal keys keep their order.
+ */
+struct sort_entry {
+	uint32_t key;
+	uint16_t index; // Where the record was before sorting
+	uint8_t empty;
+	uint8_t unused;
+};
+
+static uint32_t make_key(const struct SimplePKM *pkm, enum BoxSortKey key) {
+	uint32_t dex = pkm->isEgg ? 0xFFFF : pkm->dexNumber;
+	uint32_t total = 0;
+
+	switch (key) {
+	case BOX_SORT_LEVEL:
+		return (uint32_t) (0xFF - pkm->level) << 16 | dex;
+	case BOX_SORT_OT:
+		return (uint32_t) pkm->trainerId16[0] << 16 | pkm->trainerId16[1];
+	case BOX_SORT_SHINY:
+		return (uint32_t) !pkm->isShiny << 16 | dex;
+	case BOX_SORT_STAT_TOTAL:
+		for (int i = 0; i < 6; i++)
+			total += pkm->stats[i];
+		return (0xFFFF - total) << 16 | dex;
+	default:
+		return dex;
+	}
+}
+
+static int compare_entries(const void *a, const void *b) {
+	const struct sort_entry *x = a, *y = b;
+
+	if (x->empty != y->empty)
+		return x->empty - y->empty;
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return x->index - y->index;
+}
+
+/**
+ * Puts the record from entries[i].index at position i for every i.
+ */
+static void permute_records(uint8_t *records, uint16_t count, uint16_t size,
+	struct sort_entry *entries) {
+	uint8_t tmp[PKMX_SIZE];
+
+	for (uint16_t start = 0; start < count; start++) {
+		uint16_t dst = start;
+
+		if (entries[start].index == start)
+			continue;
+		memcpy(tmp, records + start * size, size);
+		while (entries[dst].index != start) {
+			uint16_t src = entries[dst].index;
+			memcpy(records + dst * size, records + src * size, size);
+			// Mark each placed record so its cycle isn't followed again
+			entries[dst].index = dst;
+			dst = src;
+		}
+		memcpy(records + dst * size, tmp, size);
+		entries[dst].index = dst;
+	}
+}
+
+static void make_entry(struct sort_entry *entry, const uint8_t *record,
+	uint16_t index, uint16_t gameId, enum BoxSortKey key) {
+	struct SimplePKM pkm;
+
+	if (gameId) {
+		memset(&pkm, 0, sizeof(pkm));
+		pkm.isOnCart = 1;
+		pkm3_to_simplepkm(&pkm, record);
+	} else {
+		pkmx_to_simplepkm(&pkm, record, 0);
+	}
+	entry->index = index;
+	entry->empty = !pkm.exists;
+	entry->key = pkm.exists ? make_key(&pkm, key) : 0;
+}
+
+/**
+ * Sorts count records in place. gameId is 0 for PKMX records, or the game of
+ * a cartridge's PK3 records. Returns 0 if there's not enough memory.
+ */
+int box_sort_records(uint8_t *records, uint16_t count, uint16_t gameId, enum BoxSortKey key) {
+	uint16_t size = gameId ? PKM3_SIZE : PKMX_SIZE;
+	struct sort_entry *entries;
+
+	entries = malloc(count * sizeof(*entries));
+	if (!entries)
+		return 0;
+	for (uint16_t i = 0; i < count; i++)
+		make_entry(&entries[i], records + i * size, i, gameId, key);
+	qsort(entries, count, sizeof(*entries), compare_entries);
+	permute_records(records, count, size, entries);
+	free(entries);
+	return 1;
+}
+
+/**
+ * Reads the 30 records that belong in one box from the snapshot of the
+ * range, in their sorted order.
+ */
+static int read_sorted_box(uint8_t *box, FILE *snapshot, const struct sort_entry *entries) {
+	for (int slot = 0; slot < 30; slot++) {
+		if (fseek(snapshot, (long) entries[slot].index * PKMX_SIZE, SEEK_SET) != 0 ||
+			fread(box + slot * PKMX_SIZE, 1, PKMX_SIZE, snapshot) != PKMX_SIZE)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Puts the first numBoxes boxes of the range back the way the snapshot has
+ * them, after filling one of them failed.
+ */
+static void restore_boxes(uint16_t firstBox, uint16_t numBoxes, FILE *snapshot) {
+	for (uint16_t boxIdx = 0; boxIdx < numBoxes; boxIdx++) {
+		uint8_t *box = box_cache_get(firstBox + boxIdx);
+
+		if (!box || fseek(snapshot, (long) boxIdx * SORT_BOX_BYTES, SEEK_SET) != 0 ||
+			fread(box, 1, SORT_BOX_BYTES, snapshot) != SORT_BOX_BYTES)
+			continue;
+		box_cache_mark_dirty(firstBox + boxIdx);
+	}
+}
+
+/**
+ * Sorts a range of boxes in the open SD group. The range is bigger than the
+ * box cache, so records can't be moved between boxes in place without
+ * loading the same boxes over and over. Instead, the pass that makes the
+ * sort keys also copies each box to a snapshot file, and then every box is
+ * filled in order from the snapshot. Each box is loaded twice and written
+ * back at most once, and only the sort keys are held in memory.
+ */
+int box_sort_cache(uint16_t firstBox, uint16_t numBoxes, enum BoxSortKey key) {
+	uint16_t count = numBoxes * 30;
+	struct sort_entry *entries;
+	FILE *snapshot = NULL;
+	int rc = BOX_SORT_OK;
+
+	entries = malloc(count * sizeof(*entries));
+	if (!entries)
+		return BOX_SORT_NO_MEMORY;
+	if (sd_boxes_create_dirs())
+		snapshot = sd_fopen(SORT_SNAPSHOT_PATH, "w+b", SD_FILE_RANDOM);
+	if (!snapshot) {
+		free(entries);
+		return BOX_SORT_WRITE_ERROR;
+	}
+
+	for (uint16_t boxIdx = 0; boxIdx < numBoxes && rc == BOX_SORT_OK; boxIdx++) {
+		const uint8_t *box = box_cache_get(firstBox + boxIdx);
+
+		if (!box) {
+			rc = BOX_SORT_READ_ERROR;
+		} else if (fwrite(box, 1, SORT_BOX_BYTES, snapshot) != SORT_BOX_BYTES) {
+			rc = BOX_SORT_WRITE_ERROR;
+		} else {
+			for (uint16_t slot = 0; slot < 30; slot++) {
+				uint16_t i = boxIdx * 30 + slot;
+				make_entry(&entries[i], box + slot * PKMX_SIZE, i, 0, key);
+			}
+		}
+	}
+	if (rc == BOX_SORT_OK)
+		qsort(entries, count, sizeof(*entries), compare_entries);
+
+	for (uint16_t boxIdx = 0; boxIdx < numBoxes && rc == BOX_SORT_OK; boxIdx++) {
+		const struct sort_entry *boxEntries = entries + boxIdx * 30;
+		uint8_t *box;
+		int moved = 0;
+
+		for (uint16_t slot = 0; slot < 30; slot++)
+			moved |= boxEntries[slot].index != boxIdx * 30 + slot;
+		if (!moved)
+			continue;
+		box = box_cache_get(firstBox + boxIdx);
+		if (!box || !read_sorted_box(box, snapshot, boxEntries)) {
+			restore_boxes(firstBox, box ? boxIdx + 1 : boxIdx, snapshot);
+			rc = BOX_SORT_READ_ERROR;
+		} else {
+			box_cache_mark_dirty(firstBox + boxIdx);
+		}
+	}
+
+	fclose(snapshot);
+	remove(SORT_SNAPSHOT_PATH);
+	free(entries);
+	return rc;
+}
@@ -0,0 +1,38 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+
+enum BoxSortKey {
+	BOX_SORT_DEX, // National Pokedex number
+	BOX_SORT_LEVEL, // Highest first
+	BOX_SORT_OT, // Trainer ID, then secret ID
+	BOX_SORT_SHINY, // Shiny Pokemon first, each part by Pokedex number
+	BOX_SORT_STAT_TOTAL, // Highest first
+	BOX_SORT_KEY_COUNT
+};
+
+// Results of box_sort_cache
+#define BOX_SORT_OK 1
+#define BOX_SORT_NO_MEMORY 0
+#define BOX_SORT_READ_ERROR -1
+#define BOX_SORT_WRITE_ERROR -2
+
+int box_sort_records(uint8_t *records, uint16_t count, uint16_t gameId, enum BoxSortKey key);
+int box_sort_cache(uint16_t firstBox, uint16_t numBoxes, enum BoxSortKey key);
@@ -0,0 +1,341 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "gba_flash.h"
+#include <nds.h>
+
+#include <stdint.h>
+#include <string.h>
+
+/* Driver for the flash save chips in Slot-2 GBA cartridges.
+ * Resources for the command set and chip IDs:
+ *   https://problemkaputt.de/gbatek.htm#gbacartbackupflashrom
+ *
+ * Every chip uses the same JEDEC-style command sequences; they only differ in
+ * size, timing, and whether they program single bytes or whole pages.
+ * Build with -DGBA_FLASH_LEGACY_WRITE to always use the old fixed-delay
+ * write routine, for comparing timings on hardware.
+ */
+
+#define SIZE_64K (64 * 1024)
+
+// SRAM from libnds isn't volatile, and polling needs every read to hit the bus
+#define FLASH ((volatile uint8_t*) SRAM)
+
+// Macronix and Sanyo chips take a while to enter and leave ID mode
+#define FLASH_ID_MODE_DELAY_US 20000
+
+static const struct gba_flash_chip flash_chips[] = {
+	// 128K chips used by all the Gen3 Pokemon games
+	{0xC2, 0x09, GBA_FLASH_POLL_TOGGLE, 0,   1,  2000, 0x20000, 1000000, "Macronix MX29L010"},
+	{0x62, 0x13, 0,                     0,   1,  2000, 0x20000, 2000000, "Sanyo LE26FV10N1TS"},
+	// 64K chips
+	{0x32, 0x1B, GBA_FLASH_POLL_TOGGLE, 0,   1,  2000, 0x10000, 1000000, "Panasonic MN63F805MNP"},
+	{0xC2, 0x1C, GBA_FLASH_POLL_TOGGLE, 0,   1,  2000, 0x10000, 1000000, "Macronix MX29L512"},
+	{0xBF, 0xD4, GBA_FLASH_POLL_TOGGLE, 0,   1,  1000, 0x10000,  100000, "SST SST39VF512"},
+	// Atmel has no erase command; programming a page implicitly erases it first
+	{0x1F, 0x3D, GBA_FLASH_PAGE_WRITE | GBA_FLASH_POLL_TOGGLE,
+	                                    0, 128, 20000, 0x10000,       0, "Atmel AT29LV512"}
+};
+
+// Used when the ID doesn't match any known chip
+static const struct gba_flash_chip unknown_chip = {
+	0, 0, 0, 0, 1, 0, 0x20000, 0, "Unknown"
+};
+
+static const struct gba_flash_chip *flash_chip = &unknown_chip;
+static uint8_t flash_bank = 0xFF;
+
+struct gba_flash_stats gba_flash_stats;
+
+static inline void flash_command(uint8_t cmd) {
+	FLASH[0x5555] = 0xaa;
+	FLASH[0x2aaa] = 0x55;
+	FLASH[0x5555] = cmd;
+}
+
+// The original command sequence, with a delay after every byte
+static inline void flash_command_legacy(uint8_t cmd) {
+	FLASH[0x5555] = 0xaa;
+	swiDelay(10);
+	FLASH[0x2aaa] = 0x55;
+	swiDelay(10);
+	FLASH[0x5555] = cmd;
+	swiDelay(10);
+}
+
+static inline uint32_t us_to_ticks(uint32_t us) {
+	return (uint32_t) ((uint64_t) us * BUS_CLOCK / 1000000);
+}
+
+static void flash_delay_us(uint32_t us) {
+	uint32_t start = cpuGetTiming();
+	uint32_t ticks = us_to_ticks(us);
+	while (cpuGetTiming() - start < ticks);
+}
+
+/**
+ * Switches 64K banks. Chips that weren't identified get the legacy command
+ * timing, the same as their writes.
+ */
+static void flash_set_bank(uint8_t bank, int legacy) {
+	if (flash_chip->size <= SIZE_64K || bank == flash_bank)
+		return;
+	if (legacy) {
+		flash_command_legacy(0xb0);
+		FLASH[0] = bank;
+		swiDelay(10);
+	} else {
+		flash_command(0xb0);
+		FLASH[0] = bank;
+	}
+	flash_bank = bank;
+}
+
+enum flash_compare_result {
+	FLASH_DIFFERENT,
+	FLASH_SAME,
+	FLASH_BLANK // Different, but already erased
+};
+
+static enum flash_compare_result flash_compare(uint16_t addr, const uint8_t *src, uint16_t size) {
+	int same = 1, blank = 1;
+	for (uint16_t pos = 0; pos < size && (same || blank); pos++) {
+		uint8_t cur = FLASH[addr + pos];
+		same &= cur == src[pos];
+		blank &= cur == 0xFF;
+	}
+	if (same)
+		return FLASH_SAME;
+	return blank ? FLASH_BLANK : FLASH_DIFFERENT;
+}
+
+/**
+ * Waits for an erase or program operation to finish, then checks the result.
+ * Returns 0 if the chip timed out or the final byte doesn't match.
+ */
+static int flash_wait_ready(uint16_t addr, uint8_t expect, uint32_t timeoutUs) {
+	uint32_t start = cpuGetTiming();
+	uint32_t timeout = us_to_ticks(timeoutUs);
+
+	if (flash_chip->flags & GBA_FLASH_POLL_TOGGLE) {
+		// DQ6 toggles on every read until the operation ends
+		uint8_t prev = FLASH[addr];
+		for (;;) {
+			uint8_t cur = FLASH[addr];
+			if (((prev ^ cur) & 0x40) == 0)
+				break;
+			prev = cur;
+			if (cpuGetTiming() - start > timeout)
+				goto wait_timeout;
+		}
+	} else {
+		// DQ7 reads as the complement of the written bit until the operation ends
+		while (((FLASH[addr] ^ expect) & 0x80) != 0) {
+			if (cpuGetTiming() - start > timeout)
+				goto wait_timeout;
+		}
+	}
+	return FLASH[addr] == expect;
+
+wait_timeout:
+	// A timed out operation leaves the chip in a state that needs a reset
+	flash_command(0xf0);
+	gba_flash_stats.timeouts++;
+	return 0;
+}
+
+static int flash_erase_sector(uint16_t sectorInBank) {
+	flash_command(0x80);
+	FLASH[0x5555] = 0xaa;
+	FLASH[0x2aaa] = 0x55;
+	FLASH[sectorInBank] = 0x30;
+	gba_flash_stats.sectorsErased++;
+	return flash_wait_ready(sectorInBank, 0xFF, flash_chip->eraseTimeoutUs);
+}
+
+static int flash_program_bytes(uint16_t addr, const uint8_t *src, uint16_t size) {
+	for (uint16_t pos = 0; pos < size; pos++) {
+		// Erased bytes already read as 0xFF
+		if (src[pos] == 0xFF)
+			continue;
+		flash_command(0xa0);
+		FLASH[addr + pos] = src[pos];
+		if (!flash_wait_ready(addr + pos, src[pos], flash_chip->programTimeoutUs))
+			return 0;
+	}
+	return 1;
+}
+
+static int flash_program_pages(uint16_t addr, const uint8_t *src, uint16_t size) {
+	uint16_t pageSize = flash_chip->pageSize;
+	for (uint16_t pos = 0; pos < size; pos += pageSize) {
+		int ime;
+		uint16_t last = addr + pos + pageSize - 1;
+
+		if (flash_compare(addr + pos, src + pos, pageSize) == FLASH_SAME)
+			continue;
+
+		// The whole page has to be loaded without long pauses between bytes
+		ime = enterCriticalSection();
+		flash_command(0xa0);
+		for (uint16_t i = 0; i < pageSize; i++)
+			FLASH[addr + pos + i] = src[pos + i];
+		leaveCriticalSection(ime);
+
+		if (!flash_wait_ready(last, src[pos + pageSize - 1], flash_chip->programTimeoutUs))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * The original write routine, kept for chips we can't identify. It waits a
+ * fixed delay after every bus access instead of polling the chip status.
+ */
+static int flash_write_sector_legacy(uint16_t sectorInBank, const uint8_t *src) {
+	volatile uint8_t *dst = FLASH + sectorInBank;
+
+	// Erase sector
+	flash_command_legacy(0x80);
+	FLASH[0x5555] = 0xaa;
+	swiDelay(10);
+	FLASH[0x2aaa] = 0x55;
+	swiDelay(10);
+	FLASH[sectorInBank] = 0x30;
+	swiDelay(10);
+	while (FLASH[sectorInBank] != 0xFF)
+		swiDelay(10);
+	gba_flash_stats.sectorsErased++;
+
+	// Write bytes
+	for (uint16_t pos = 0; pos < 0x1000; pos++) {
+		uint8_t srcByte = *src;
+		flash_command_legacy(0xa0);
+		*dst = srcByte;
+		swiDelay(10);
+		while (*dst != srcByte)
+			swiDelay(10);
+		src++;
+		dst++;
+	}
+	return 1;
+}
+
+/**
+ * Identifies the flash chip in the inserted cartridge.
+ * Returns NULL for unknown chips, which are still readable but get written
+ * with the slow fixed-delay routine.
+ */
+const struct gba_flash_chip* gba_flash_init(void) {
+	uint8_t manufacturer, device;
+
+	sysSetBusOwners(true, true);
+	swiDelay(10);
+	cpuStartTiming(2);
+
+	flash_command(0x90);
+	flash_delay_us(FLASH_ID_MODE_DELAY_US);
+	manufacturer = FLASH[0];
+	device = FLASH[1];
+	flash_command(0xf0);
+	flash_delay_us(FLASH_ID_MODE_DELAY_US);
+	cpuEndTiming();
+
+	flash_bank = 0xFF;
+	flash_chip = &unknown_chip;
+	for (size_t i = 0; i < sizeof(flash_chips) / sizeof(flash_chips[0]); i++) {
+		if (flash_chips[i].manufacturer == manufacturer && flash_chips[i].device == device) {
+			flash_chip = &flash_chips[i];
+			return flash_chip;
+		}
+	}
+	return NULL;
+}
+
+int gba_flash_read(uint8_t *out, uint32_t offset, uint32_t size) {
+	if (offset + size > flash_chip->size)
+		return 0;
+
+	while (size) {
+		uint16_t inBank = offset & 0xFFFF;
+		uint32_t chunk = SIZE_64K - inBank;
+		if (chunk > size)
+			chunk = size;
+		flash_set_bank(offset >> 16, flash_chip == &unknown_chip);
+		for (uint32_t i = 0; i < chunk; i++)
+			out[i] = FLASH[inBank + i];
+		out += chunk;
+		offset += chunk;
+		size -= chunk;
+	}
+	return 1;
+}
+
+/**
+ * Erases and programs whole 4K sectors. seek and size must be sector-aligned.
+ * Sectors that already hold the same data are left alone.
+ */
+int gba_flash_write(const uint8_t *data, uint32_t seek, uint32_t size) {
+	int success = 1;
+	int legacy = flash_chip == &unknown_chip;
+
+#ifdef GBA_FLASH_LEGACY_WRITE
+	legacy = 1;
+#endif
+
+	if ((seek & 0xFFF) || (size & 0xFFF) || seek + size > flash_chip->size)
+		return 0;
+
+	memset(&gba_flash_stats, 0, sizeof(gba_flash_stats));
+	cpuStartTiming(2);
+
+	for (uint32_t sector = seek; sector < seek + size && success;
+		sector += GBA_FLASH_SECTOR_SIZE) {
+		uint16_t sectorInBank = sector & 0xFFFF;
+		const uint8_t *src = data + (sector - seek);
+		enum flash_compare_result cmp;
+
+		flash_set_bank(sector >> 16, legacy);
+
+		// Reading back is much cheaper than an erase and 4096 byte programs
+		cmp = flash_compare(sectorInBank, src, GBA_FLASH_SECTOR_SIZE);
+		if (cmp == FLASH_SAME) {
+			gba_flash_stats.sectorsSkipped++;
+			continue;
+		}
+
+		if (legacy) {
+			success = flash_write_sector_legacy(sectorInBank, src);
+		} else if (flash_chip->flags & GBA_FLASH_PAGE_WRITE) {
+			success = flash_program_pages(sectorInBank, src, GBA_FLASH_SECTOR_SIZE);
+		} else {
+			success =
+				(cmp == FLASH_BLANK || flash_erase_sector(sectorInBank)) &&
+				flash_program_bytes(sectorInBank, src, GBA_FLASH_SECTOR_SIZE);
+		}
+		if (success)
+			gba_flash_stats.writeBytes += GBA_FLASH_SECTOR_SIZE;
+	}
+
+	gba_flash_stats.writeTicks = cpuEndTiming();
+	return success;
+}
+
+uint32_t gba_flash_ticks_to_ms(uint32_t ticks) {
+	return (uint32_t) ((uint64_t) ticks * 1000 / BUS_CLOCK);
+}
@@ -0,0 +1,55 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define GBA_FLASH_SECTOR_SIZE 0x1000
+
+// The chip programs a whole page per command instead of single bytes (Atmel)
+#define GBA_FLASH_PAGE_WRITE 0x01
+// Completion is detected with DQ6 toggling instead of DQ7 data polling
+#define GBA_FLASH_POLL_TOGGLE 0x02
+
+struct gba_flash_chip {
+	uint8_t manufacturer;
+	uint8_t device;
+	uint8_t flags;
+	uint8_t unused;
+	uint16_t pageSize;
+	uint16_t programTimeoutUs;
+	uint32_t size;
+	uint32_t eraseTimeoutUs;
+	const char *name;
+};
+
+struct gba_flash_stats {
+	uint32_t writeTicks; // Duration of the last gba_flash_write in BUS_CLOCK ticks
+	uint32_t writeBytes;
+	uint16_t sectorsErased;
+	uint16_t sectorsSkipped; // Sectors that already held the same data
+	uint16_t timeouts;
+	uint16_t unused;
+};
+
+extern struct gba_flash_stats gba_flash_stats;
+
+const struct gba_flash_chip* gba_flash_init(void);
+int gba_flash_read(uint8_t *out, uint32_t offset, uint32_t size);
+int gba_flash_write(const uint8_t *data, uint32_t offset, uint32_t size);
+uint32_t gba_flash_ticks_to_ms(uint32_t ticks);
@@ -102,7 +102,7 @@
 // Sprite gfx = SPRITE_GFX + GFXIDX * 128
 // The boundary size is 128 because we pass SpriteMapping_1D_128 to oamInit
 #define OBJ_GFXIDX_BIGSPRITE 0x80
-#define OBJ_GFXIDX_HOLDING 0x100
-#define OBJ_GFXIDX_CURBOX 0x200
+#define OBJ_GFXIDX_ICONS 0x100 // Box icon atlas, up to 0x300 on the bottom screen
+#define OBJ_GFXIDX_CURBOX 0x200 // Top screen summary
 
 void draw_gui_tilemap(const tilemap_t *tilemap, uint8_t screen, uint8_t x, uint8_t y);
@@ -0,0 +1,94 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "icon_atlas.h"
+#include <nds.h>
+#include <string.h>
+
+#include "asset_manager.h"
+#include "gui_util.h"
+
+/* Pokemon box icons on the bottom screen share their tiles in sprite VRAM.
+ * Each slot of the atlas holds the 2 animation frames of one icon (1024
+ * bytes, 8 gfx units) and counts the sprites pointing at it, so a box full
+ * of the same species uploads its icon only once. Slots nothing refers to
+ * anymore keep their tiles until another icon needs the space, which lets
+ * switching back and forth between boxes skip most uploads.
+ */
+#define ICON_ATLAS_SLOTS 64
+#define ICON_ATLAS_SLOT_GFX 8
+#define ICON_ATLAS_EMPTY 0
+
+struct icon_atlas_slot {
+	uint16_t icon; // Species and generation, as passed to getIconImage
+	uint16_t refCount;
+	uint32_t lastUse;
+};
+
+struct icon_atlas_stats icon_atlas_stats;
+
+static struct icon_atlas_slot atlasSlots[ICON_ATLAS_SLOTS];
+static uint32_t atlasClock;
+
+void icon_atlas_reset(void) {
+	memset(atlasSlots, 0, sizeof(atlasSlots));
+	atlasClock = 0;
+}
+
+/**
+ * Returns the gfxIndex of an icon's tiles, uploading them if they aren't
+ * already resident. Every call must be matched by icon_atlas_release.
+ */
+uint16_t icon_atlas_acquire(uint16_t icon) {
+	struct icon_atlas_slot *slot;
+	int slotIdx = -1;
+
+	for (int i = 0; i < ICON_ATLAS_SLOTS; i++) {
+		if (atlasSlots[i].icon == icon && icon != ICON_ATLAS_EMPTY) {
+			icon_atlas_stats.hits++;
+			atlasSlots[i].refCount++;
+			atlasSlots[i].lastUse = ++atlasClock;
+			return OBJ_GFXIDX_ICONS + i * ICON_ATLAS_SLOT_GFX;
+		}
+		// Prefer an empty slot, then the least recently used unreferenced one
+		if (atlasSlots[i].refCount == 0 && (slotIdx < 0 ||
+				atlasSlots[i].lastUse < atlasSlots[slotIdx].lastUse))
+			slotIdx = i;
+	}
+	if (slotIdx < 0)
+		return ICON_ATLAS_FULL;
+
+	icon_atlas_stats.uploads++;
+	slot = &atlasSlots[slotIdx];
+	slot->icon = icon;
+	slot->refCount = 1;
+	slot->lastUse = ++atlasClock;
+	// Each 32x32@4bpp sprite is 512 bytes.
+	// 2 animation frames at 512 bytes each = 1024 bytes per Pokemon.
+	dmaCopy(getIconImage(icon),
+		(uint8_t*) SPRITE_GFX_SUB + (OBJ_GFXIDX_ICONS + slotIdx * ICON_ATLAS_SLOT_GFX) * 128,
+		1024);
+	return OBJ_GFXIDX_ICONS + slotIdx * ICON_ATLAS_SLOT_GFX;
+}
+
+void icon_atlas_release(uint16_t gfxIndex) {
+	int slotIdx = (gfxIndex - OBJ_GFXIDX_ICONS) / ICON_ATLAS_SLOT_GFX;
+
+	if (slotIdx < 0 || slotIdx >= ICON_ATLAS_SLOTS || atlasSlots[slotIdx].refCount == 0)
+		return;
+	atlasSlots[slotIdx].refCount--;
+}
@@ -0,0 +1,34 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+
+// Returned by icon_atlas_acquire when every atlas slot is in use
+#define ICON_ATLAS_FULL 0xFFFF
+
+struct icon_atlas_stats {
+	uint32_t hits;
+	uint32_t uploads;
+};
+
+extern struct icon_atlas_stats icon_atlas_stats;
+
+void icon_atlas_reset(void);
+uint16_t icon_atlas_acquire(uint16_t icon);
+void icon_atlas_release(uint16_t gfxIndex);
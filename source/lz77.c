@@ -18,20 +18,124 @@
 #include "lz77.h"
 
 #include <stddef.h>
+#include <string.h>
 #include <nds.h>
 
 #include "util.h"
 
-uint32_t lz77_extract(void *dest, const uint32_t *src, uint32_t dest_max) {
+/* The decoder runs as ARM code from ITCM on the DS, so its inner loop
+ * doesn't wait on main RAM for instruction fetches. The host build uses
+ * the same C code for the benchmarks.
+ */
+#ifdef ARM9
+#define LZ77_DECODER_CODE ITCM_CODE ARM_CODE
+#else
+#define LZ77_DECODER_CODE
+#endif
+
+// Back-references at least this long go through memcpy when they don't overlap
+#define LZ77_MEMCPY_MIN 8
+
+/**
+ * Copies a back-reference. An overlapping copy repeats the last disp bytes,
+ * so a distance of 1 is a fill. With a distance of 4 or more, each 4-byte
+ * chunk only reads bytes that are already written, so the copy can go a
+ * word at a time even when the whole reference overlaps. Distances of 2
+ * and 3 go byte by byte. Long copies that don't overlap use memcpy.
+ */
+static inline void copy_match(uint8_t *out, uint32_t disp, uint32_t len) {
+	const uint8_t *from = out - disp;
+
+	if (disp == 1) {
+		memset(out, from[0], len);
+		return;
+	}
+	if (disp >= len && len >= LZ77_MEMCPY_MIN) {
+		memcpy(out, from, len);
+		return;
+	}
+	if (disp >= 4) {
+		for (; len >= 4; len -= 4, out += 4, from += 4) {
+			uint32_t word;
+			// Both may be unaligned, which memcpy of a word handles on ARMv5TE
+			memcpy(&word, from, 4);
+			memcpy(out, &word, 4);
+		}
+	}
+	while (len--)
+		*out++ = *from++;
+}
+
+/**
+ * Decodes LZ77 (type 0x10) data without reading past src_max bytes of input
+ * or writing past dest_max bytes of output. Returns the extracted size, or 0
+ * if the data is invalid, truncated or too big for dest.
+ */
+LZ77_DECODER_CODE
+uint32_t lz77_extract_bounded(void *dest, const uint32_t *src, uint32_t dest_max,
+	uint32_t src_max) {
+	const uint8_t *in = (const uint8_t*) src;
+	const uint8_t *in_end;
+	uint8_t *out = dest;
+	uint8_t *out_end;
 	uint32_t len;
 
-	if (src == NULL || (len = src[0] >> 8) > dest_max)
+	if (src == NULL || src_max < 4 || (src[0] & 0xF0) != 0x10 ||
+		(len = src[0] >> 8) > dest_max)
 		return 0;
 
-	swiDecompressLZSSWram((void*) src, dest);
+	// Keep the end pointer from wrapping when the input length is unknown
+	in_end = in + MIN(src_max, (uint32_t) (UINTPTR_MAX - (uintptr_t) in));
+	out_end = out + len;
+	in += 4;
+
+	while (out < out_end) {
+		uint8_t flags;
+
+		if (in >= in_end)
+			return 0;
+		flags = *in++;
+
+		// A whole block of literals, which is common in noisy graphics
+		if (flags == 0 && out_end - out >= 8 && in_end - in >= 8) {
+			memcpy(out, in, 8);
+			out += 8;
+			in += 8;
+			continue;
+		}
+
+		for (int i = 0; i < 8 && out < out_end; i++, flags <<= 1) {
+			if ((flags & 0x80) == 0) {
+				if (in >= in_end)
+					return 0;
+				*out++ = *in++;
+			} else {
+				uint32_t copyLen, disp;
+
+				if (in_end - in < 2)
+					return 0;
+				copyLen = (in[0] >> 4) + 3;
+				disp = ((in[0] & 0xF) << 8 | in[1]) + 1;
+				in += 2;
+				if (disp > (uint32_t) (out - (uint8_t*) dest))
+					return 0;
+				copyLen = MIN(copyLen, (uint32_t) (out_end - out));
+				copy_match(out, disp, copyLen);
+				out += copyLen;
+			}
+		}
+	}
 	return len;
 }
 
+/**
+ * Like lz77_extract_bounded, for data whose compressed length isn't known,
+ * such as tables in the cartridge ROM.
+ */
+uint32_t lz77_extract(void *dest, const uint32_t *src, uint32_t dest_max) {
+	return lz77_extract_bounded(dest, src, dest_max, UINT32_MAX);
+}
+
 uint32_t lz77_extracted_size(const uint32_t *src) {
 	return src[0] >> 8;
 }
@@ -20,6 +20,8 @@
 #include <stdint.h>
 
 uint32_t lz77_extract(void *dest, const uint32_t *src, uint32_t dest_max);
+uint32_t lz77_extract_bounded(void *dest, const uint32_t *src, uint32_t dest_max,
+	uint32_t src_max);
 uint32_t lz77_extracted_size(const uint32_t *src);
 uint32_t lz77_compressed_size(const uint32_t *src, uint32_t src_max);
 uint32_t lz77_truncate(uint32_t *lzdata, uint32_t lzdata_len, uint32_t target_extracted_len);
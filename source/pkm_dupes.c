@@ -0,0 +1,209 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "pkm_dupes.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "box_cache.h"
+#include "pkmx_format.h"
+#include "savedata_gen3.h"
+#include "sd_search.h"
+#include "util.h"
+
+/* Every occupied slot gets a fingerprint: the cartridge's PK3 records are
+ * hashed directly, and the SD groups' come from their search indexes, so no
+ * SD box has to be read. The fingerprints then go in an open-addressing hash
+ * table, where each bucket is the first of a chain of slots with the same
+ * fingerprint. Any chain longer than one slot is a set of duplicates.
+ *
+ * The SD group open in the box cache may have changes that aren't saved yet.
+ * Its boxes that changed are fingerprinted from the cache instead of the
+ * index. A Pokemon the cursor is holding is still in the box it was picked
+ * up from until it's put down, so it's found there.
+ *
+ * The trainer ID is compared too. It's part of what's hashed, but checking
+ * it makes it less likely that a CRC32 collision passes for a duplicate.
+ */
+struct fingerprint {
+	uint32_t hash;
+	uint32_t trainerId;
+	int32_t next; // The next slot with the same fingerprint, or -1
+	uint8_t group;
+	uint8_t box;
+	uint8_t slot;
+	uint8_t unused;
+};
+
+struct dupes_ctx {
+	struct fingerprint *prints;
+	int32_t count;
+	int32_t capacity;
+	int nomem;
+	uint8_t openGroup; // SD group open in the box cache, or DUPES_NO_GROUP
+};
+
+static int add_print(struct dupes_ctx *ctx, uint32_t hash, uint32_t trainerId,
+	uint8_t group, uint16_t pos) {
+	struct fingerprint *print;
+
+	if (ctx->count >= ctx->capacity) {
+		int32_t capacity = ctx->capacity ? ctx->capacity * 2 : 1024;
+		struct fingerprint *prints = realloc(ctx->prints, capacity * sizeof(*prints));
+		if (!prints) {
+			ctx->nomem = 1;
+			return 0;
+		}
+		ctx->prints = prints;
+		ctx->capacity = capacity;
+	}
+	print = &ctx->prints[ctx->count++];
+	print->hash = hash;
+	print->trainerId = trainerId;
+	print->next = -1;
+	print->group = group;
+	print->box = pos / 30;
+	print->slot = pos % 30;
+	return 1;
+}
+
+static int add_sd_print(const struct sd_search_result *result, void *arg) {
+	struct dupes_ctx *ctx = arg;
+
+	if (result->group == ctx->openGroup && box_cache_box_changed(result->box))
+		return 1;
+	return add_print(ctx, result->entry.hash, result->entry.trainerId,
+		result->group, result->box * 30 + result->slot);
+}
+
+/**
+ * Fingerprints the boxes of the open group that changed since its index was
+ * written. A box that can't be read is left out.
+ */
+static int add_changed_prints(struct dupes_ctx *ctx, uint16_t openBoxes) {
+	struct sd_search_entry entry;
+
+	for (uint16_t boxIdx = 0; boxIdx < openBoxes; boxIdx++) {
+		const uint8_t *box;
+
+		if (!box_cache_box_changed(boxIdx) || !(box = box_cache_get(boxIdx)))
+			continue;
+		for (uint16_t slot = 0; slot < 30; slot++) {
+			sd_search_make_entry(&entry, box + slot * PKMX_SIZE);
+			if (entry.species == 0)
+				continue;
+			if (!add_print(ctx, entry.hash, entry.trainerId, ctx->openGroup,
+				boxIdx * 30 + slot))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static int same_pokemon(const struct fingerprint *a, const struct fingerprint *b) {
+	return a->hash == b->hash && a->trainerId == b->trainerId;
+}
+
+/**
+ * Chains every fingerprint onto the first one with the same hash and trainer
+ * ID. Returns the table of chain heads, or NULL if there's not enough memory.
+ */
+static int32_t* build_table(struct dupes_ctx *ctx, uint32_t *mask_out) {
+	uint32_t size = 1;
+	int32_t *table;
+
+	// At most half full, so probe runs stay short
+	while (size < (uint32_t) ctx->count * 2)
+		size <<= 1;
+	table = malloc(size * sizeof(*table));
+	if (!table)
+		return NULL;
+	memset(table, 0xFF, size * sizeof(*table));
+
+	for (int32_t i = ctx->count - 1; i >= 0; i--) {
+		struct fingerprint *print = &ctx->prints[i];
+		uint32_t bucket = print->hash & (size - 1);
+
+		while (table[bucket] >= 0 && !same_pokemon(&ctx->prints[table[bucket]], print))
+			bucket = (bucket + 1) & (size - 1);
+		// Going backwards and pushing on the front keeps each chain in slot order
+		print->next = table[bucket];
+		table[bucket] = i;
+	}
+	*mask_out = size - 1;
+	return table;
+}
+
+/**
+ * Finds every Pokemon that is stored more than once in the cartridge's boxes
+ * and the SD groups. cartBoxes holds cartSlots PK3 records of game gameId,
+ * and can be NULL to only check the SD card. openGroup is the SD group open
+ * in the box cache with openBoxes boxes, or DUPES_NO_GROUP; the other groups
+ * are checked as of their last save.
+ * Each duplicate location is stored in dupes, with the locations of a set
+ * next to each other. Returns how many were stored, or -1 if there's not
+ * enough memory.
+ */
+int find_duplicates(const uint8_t *cartBoxes, uint16_t cartSlots, uint16_t gameId,
+	uint8_t openGroup, uint16_t openBoxes, struct pkm_dupe *dupes, int maxDupes) {
+	struct dupes_ctx ctx = {NULL, 0, 0, 0, openGroup};
+	uint32_t mask;
+	int32_t *table;
+	int numDupes = 0;
+	uint16_t set = 0;
+
+	for (uint16_t pos = 0; cartBoxes && pos < cartSlots; pos++) {
+		const uint8_t *pkm = cartBoxes + pos * PKM3_SIZE;
+		if (pkm3_classify_slot(pkm) == PKM3_SLOT_EMPTY)
+			continue;
+		// The trainer ID isn't encrypted, it's the same in the PKMX copy
+		if (!add_print(&ctx, pkm_fingerprint(pkm, gameId), GET32(pkm, 4),
+			DUPES_GROUP_CART, pos))
+			goto dupes_nomem;
+	}
+	sd_search_for_each(add_sd_print, &ctx);
+	if (ctx.nomem)
+		goto dupes_nomem;
+	if (openGroup != DUPES_NO_GROUP && !add_changed_prints(&ctx, openBoxes))
+		goto dupes_nomem;
+
+	table = build_table(&ctx, &mask);
+	if (!table)
+		goto dupes_nomem;
+	for (uint32_t bucket = 0; bucket <= mask && numDupes < maxDupes; bucket++) {
+		int32_t i = table[bucket];
+		if (i < 0 || ctx.prints[i].next < 0)
+			continue;
+		for (; i >= 0 && numDupes < maxDupes; i = ctx.prints[i].next) {
+			struct pkm_dupe *dupe = &dupes[numDupes++];
+			dupe->hash = ctx.prints[i].hash;
+			dupe->set = set;
+			dupe->group = ctx.prints[i].group;
+			dupe->box = ctx.prints[i].box;
+			dupe->slot = ctx.prints[i].slot;
+		}
+		set++;
+	}
+	free(table);
+	free(ctx.prints);
+	return numDupes;
+
+dupes_nomem:
+	free(ctx.prints);
+	return -1;
+}
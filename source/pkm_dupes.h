@@ -0,0 +1,36 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+
+// Group number for the cartridge's boxes, the same one the box GUI uses
+#define DUPES_GROUP_CART 0x40
+// No SD group is open in the box cache
+#define DUPES_NO_GROUP 0xFF
+
+struct pkm_dupe {
+	uint32_t hash; // pkm_fingerprint of the Pokemon
+	uint16_t set; // Locations in the same set hold the same Pokemon
+	uint8_t group; // SD group number, or DUPES_GROUP_CART
+	uint8_t box;
+	uint8_t slot;
+};
+
+int find_duplicates(const uint8_t *cartBoxes, uint16_t cartSlots, uint16_t gameId,
+	uint8_t openGroup, uint16_t openBoxes, struct pkm_dupe *dupes, int maxDupes);
@@ -19,6 +19,7 @@
 #include "pkmx_format.h"
 
 #include <string.h>
+#include "crc32.h"
 #include "savedata_gen3.h"
 #include "util.h"
 
@@ -28,18 +29,27 @@ void pkm_to_pkmx(uint8_t *pkmx, const uint8_t *pkm, uint16_t gameId) {
 	if (gameId == 0) {
 		memcpy(pkmx, pkm, PKMX_SIZE);
 	} else if (generation == 3) {
-		pkm3_t decoded;
 		memset(pkmx, 0, PKMX_SIZE);
-		// TODO Can we determine whether a space is empty without decoding?
-		// A lot of the other fields seem to be garbage data, not zero.
-		decode_pkm_encrypted_data(&decoded, pkm);
-		if (decoded.species == 0)
+		if (pkm3_classify_slot(pkm) == PKM3_SLOT_EMPTY)
 			return;
 		SET16(pkmx, 0) = gameId;
 		memcpy(pkmx + 4, pkm, PKM3_SIZE);
 	}
 }
 
+/**
+ * Hashes the Pokemon in a PK3 record (gameId != 0) or PKMX record. A Gen3
+ * Pokemon gets the same fingerprint in both, since the PKMX header only says
+ * which game it was last in.
+ */
+uint32_t pkm_fingerprint(const uint8_t *pkm, uint16_t gameId) {
+	if (gameId)
+		return crc32(pkm, PKM3_SIZE, 0);
+	if (pkm[0] == 3)
+		return crc32(pkm + 4, PKM3_SIZE, 0);
+	return crc32(pkm, PKMX_SIZE, 0);
+}
+
 int pkmx_convert_generation(uint8_t *pkmx, int generation) {
 	if (pkmx[0] == 0 || pkmx[0] == generation || generation == 0)
 		return 1;
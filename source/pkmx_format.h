@@ -99,6 +99,7 @@ struct SimplePKM {
 };
 
 void pkm_to_pkmx(uint8_t *pkmx, const uint8_t *pkm, uint16_t gameId);
+uint32_t pkm_fingerprint(const uint8_t *pkm, uint16_t gameId);
 int pkmx_convert_generation(uint8_t *pkmx, int generation);
 int pkmx_to_pkm(uint8_t *pkm, uint8_t *pkmx, int generation);
 void pkmx_to_simplepkm(struct SimplePKM *simple, const uint8_t *pkmx, int is_cart);
@@ -2386,6 +2386,35 @@ const char* get_ability_name(unsigned index) {
 	return abilityNames[index];
 }
 
+/**
+ * Finds the level for an amount of experience, the same as counting how many
+ * entries of experienceTables[growth] are less than or equal to exp.
+ * The search takes the same 7 steps for every input and has no
+ * data-dependent branches. If exp_to_next isn't NULL, it receives the
+ * experience still needed for the next level, or 0 at the maximum level.
+ */
+uint8_t gen3_exp_to_level(unsigned growth, uint32_t exp, uint32_t *exp_to_next) {
+	const uint32_t *table, *base;
+	unsigned len = 100;
+	uint8_t level;
+
+	if (growth >= ARRAY_LENGTH(experienceTables)) {
+		if (exp_to_next)
+			*exp_to_next = 0;
+		return 0;
+	}
+	table = base = experienceTables[growth];
+	while (len > 1) {
+		unsigned half = len / 2;
+		base += (base[half] <= exp) ? half : 0;
+		len -= half;
+	}
+	level = (base - table) + (*base <= exp);
+	if (exp_to_next)
+		*exp_to_next = level < 100 ? table[level] - exp : 0;
+	return level;
+}
+
 uint8_t gen3_tmhm_type(unsigned item) {
 	uint16_t move_idx;
 	if (item < 0x121 || item > 0x15A)
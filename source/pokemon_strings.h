@@ -31,3 +31,4 @@ const char* get_egg_group_name(unsigned index);
 const char* get_nature_name(unsigned index);
 const char* get_ability_name(unsigned index);
 uint8_t gen3_tmhm_type(unsigned item_index);
+uint8_t gen3_exp_to_level(unsigned growth, uint32_t exp, uint32_t *exp_to_next);
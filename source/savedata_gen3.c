@@ -22,9 +22,11 @@
 #include <stdint.h>
 
 #include "asset_manager.h"
+#include "gba_flash.h"
 #include "message_window.h"
 #include "pkmx_format.h"
 #include "pokemon_strings.h"
+#include "sd_file.h"
 #include "string_gen3.h"
 #include "utf8.h"
 #include "util.h"
@@ -34,10 +36,14 @@
  * For Gen4, see https://projectpokemon.org/docs/gen-4/dp-save-structure-r74/
  */
 
-uint8_t savedata_buffer[SAVEDATA_NUM_SECTIONS * 0x1000];
+uint8_t savedata_buffer[SAVEDATA_NUM_SECTIONS * 0x1000] __attribute__((aligned(4)));
 uint32_t savedata_sections[SAVEDATA_NUM_SECTIONS];
 int savedata_active_slot = -1;
 uint32_t savedata_index;
+uint16_t savedata_dirty_sections;
+
+// Unfolded 32-bit sum of each section's checksummed words, kept up to date by savedata_write
+static uint32_t section_sums[SAVEDATA_NUM_SECTIONS];
 
 static const char *savedata_file = NULL;
 
@@ -71,9 +77,10 @@ union SaveSlotFooter {
 
 /**
  * Validates savedata for a single save slot and determines its section offsets.
+ * If sums_out isn't NULL, it receives the unfolded checksum of each section.
  */
-static int verify_savedata_slot(const uint8_t *savedata, uint32_t *sections_out,
-	uint32_t *saveidx_out) {
+static int verify_slot(const uint8_t *savedata, uint32_t *sections_out,
+	uint32_t *sums_out, uint32_t *saveidx_out) {
 
 	uint32_t saveidx = UINT32_MAX;
 	uint16_t populated_sections = 0;
@@ -82,7 +89,7 @@ static int verify_savedata_slot(const uint8_t *savedata, uint32_t *sections_out,
 
 	for (int sectionIdx = 0; sectionIdx < SAVEDATA_NUM_SECTIONS; sectionIdx++) {
 		const uint8_t *section = NULL;
-		uint32_t checksum = 0;
+		uint32_t checksum = 0, sum;
 		size_t last_nonzero = 0;
 		long section_offset = 0;
 		int wasAllFF = isAllFF;
@@ -99,6 +106,7 @@ static int verify_savedata_slot(const uint8_t *savedata, uint32_t *sections_out,
 				last_nonzero = wordIdx;
 			isAllFF = (word == 0xFFFFFFFF);
 		}
+		sum = checksum;
 		checksum = (checksum & 0xFFFF) + (checksum >> 16);
 		checksum &= 0xFFFF;
 
@@ -138,104 +146,146 @@ static int verify_savedata_slot(const uint8_t *savedata, uint32_t *sections_out,
 		populated_sections |= 1 << footer.section_id;
 		saveidx = footer.saveidx;
 		sections_out[footer.section_id] = section_offset;
+		if (sums_out)
+			sums_out[footer.section_id] = sum;
 	}
 
 	*saveidx_out = saveidx;
 	return 1;
 }
 
-#define SIZE_64K (64 * 1024)
-
-static inline void slot2_sendFlashCommand(uint8_t cmd) {
-	SRAM[0x5555] = 0xaa;
-	swiDelay(10);
-	SRAM[0x2aaa] = 0x55;
-	swiDelay(10);
-	SRAM[0x5555] = cmd;
-	swiDelay(10);
+int verify_savedata_slot(const uint8_t *savedata, uint32_t *sections_out,
+	uint32_t *saveidx_out) {
+	return verify_slot(savedata, sections_out, NULL, saveidx_out);
 }
 
-static void slot2_eraseFlashSector(uint16_t sector) {
-	slot2_sendFlashCommand(0x80);
-	SRAM[0x5555] = 0xaa;
-	swiDelay(10);
-	SRAM[0x2aaa] = 0x55;
-	swiDelay(10);
-	SRAM[sector] = 0x30;
-	swiDelay(10);
-}
+static void update_section_checksum(int sectionIdx) {
+	uint32_t checksum = section_sums[sectionIdx];
+	union SaveSlotFooter *footer;
 
-static int readSlot2Save(uint8_t *out) {
-	sysSetBusOwners(true, true);
-	swiDelay(10);
+	// Footer is the last 16 bytes of each section
+	footer = ((union SaveSlotFooter*) (GET_SAVEDATA_SECTION(sectionIdx) + 0xFF0));
 
-	// All main GBA Pokemon games use the SRAM type: FLASH1M_V103
-	// That 1 Mb (128 kB) save data is exactly 2 banks of 64k.
-	for (int bankIdx = 0; bankIdx < 2; bankIdx++) {
-		// Flash command for switching banks
-		slot2_sendFlashCommand(0xb0);
-		SRAM[0] = bankIdx;
-		swiDelay(10);
+	checksum = (checksum & 0xFFFF) + (checksum >> 16);
+	checksum &= 0xFFFF;
+	footer->checksum = (uint16_t) checksum;
+}
 
-		for (int i = 0; i < SIZE_64K; i++) {
-			out[i] = SRAM[i];
+/**
+ * Copies data into a section of savedata_buffer. Every modification to the
+ * loaded save should go through this so the section checksum can be updated
+ * by the difference of each changed word instead of re-summing the section.
+ */
+void savedata_write(int sectionIdx, uint32_t offset, const void *data, uint32_t size) {
+	uint8_t *section = GET_SAVEDATA_SECTION(sectionIdx);
+	const uint8_t *src = data;
+	uint32_t sum = section_sums[sectionIdx];
+	int changed = 0;
+
+	while (size) {
+		uint32_t wordOffset = offset & ~3;
+		uint32_t inWord = offset & 3;
+		uint32_t count = 4 - inWord;
+		uint32_t oldWord, newWord;
+
+		if (count > size)
+			count = size;
+		oldWord = GET32(section, wordOffset);
+		if (count == 4) {
+			memcpy(&newWord, src, 4);
+		} else {
+			newWord = oldWord;
+			memcpy((uint8_t*) &newWord + inWord, src, count);
+		}
+		if (newWord != oldWord) {
+			SET32(section, wordOffset) = newWord;
+			// The footer isn't part of the checksum
+			if (wordOffset < 0xFF0)
+				sum += newWord - oldWord;
+			changed = 1;
 		}
-		out += SIZE_64K;
+		src += count;
+		offset += count;
+		size -= count;
 	}
 
-	return 1;
+	if (changed) {
+		section_sums[sectionIdx] = sum;
+		savedata_dirty_sections |= 1 << sectionIdx;
+	}
 }
 
-static int writeSlot2Save(uint8_t *data, uint32_t seek, uint32_t size) {
-	if ((seek & 0xFFF) || (size & 0xFFF))
-		return 0;
-	for (uint32_t sector = seek; sector < seek + size; sector += 0x1000) {
-		uint16_t sectorInBank = sector & 0xFFFF;
-		uint8_t *src = data + (sector - seek);
-		uint8_t *dst = SRAM + sectorInBank;
-
-		if (sector == seek || sector == SIZE_64K) {
-			// Change bank
-			slot2_sendFlashCommand(0xb0);
-			SRAM[0] = sector >> 16;
-		}
+static void savedata_write8(int sectionIdx, uint32_t offset, uint8_t value) {
+	savedata_write(sectionIdx, offset, &value, 1);
+}
+
+static void savedata_write16(int sectionIdx, uint32_t offset, uint16_t value) {
+	savedata_write(sectionIdx, offset, &value, 2);
+}
+
+static void savedata_write32(int sectionIdx, uint32_t offset, uint32_t value) {
+	savedata_write(sectionIdx, offset, &value, 4);
+}
+
+/**
+ * Reads part of the save from the file if one is open, otherwise from the cartridge.
+ */
+static int read_save_range(FILE *fp, uint8_t *out, uint32_t offset, uint32_t size) {
+	if (fp)
+		return fseek(fp, offset, SEEK_SET) == 0 && fread(out, 1, size, fp) == size;
+	return gba_flash_read(out, offset, size);
+}
 
-		// Erase sector
-		slot2_eraseFlashSector(sectorInBank);
-		while (SRAM[sectorInBank] != 0xFF)
-			swiDelay(10);
-
-		// Write bytes
-		for (uint16_t pos = 0; pos < 0x1000; pos++) {
-			uint8_t srcByte = *src;
-			slot2_sendFlashCommand(0xa0);
-			*dst = srcByte;
-			swiDelay(10);
-			while (*dst != srcByte)
-				swiDelay(10);
-			src++;
-			dst++;
+/**
+ * Checks only the 14 section footers of a save slot, without reading any data.
+ * Returns 1 if they are consistent, 0 if the slot was never written,
+ * or -1 if the footers don't belong to a complete save.
+ */
+static int read_slot_footers(FILE *fp, int slotIdx, uint32_t *saveidx_out) {
+	union SaveSlotFooter footer;
+	uint16_t populated_sections = 0;
+	uint32_t saveidx = UINT32_MAX;
+	int numFF = 0;
+
+	for (int sectionIdx = 0; sectionIdx < SAVEDATA_NUM_SECTIONS; sectionIdx++) {
+		uint32_t offset = slotIdx * sizeof(savedata_buffer) + sectionIdx * 0x1000 + 0xFF0;
+		if (!read_save_range(fp, footer.bytes, offset, 16))
+			return -1;
+		if (footer.signature == UINT32_MAX && footer.saveidx == UINT32_MAX) {
+			numFF++;
+			continue;
 		}
+		if (footer.signature != 0x08012025 || footer.section_id >= SAVEDATA_NUM_SECTIONS)
+			return -1;
+		if (sectionIdx != 0 && footer.saveidx != saveidx)
+			return -1;
+		if ((populated_sections & (1 << footer.section_id)))
+			return -1;
+		populated_sections |= 1 << footer.section_id;
+		saveidx = footer.saveidx;
 	}
+	if (numFF == SAVEDATA_NUM_SECTIONS)
+		return 0;
+	if (numFF)
+		return -1;
+	*saveidx_out = saveidx;
 	return 1;
 }
 
-
 int load_savedata(const char *filename) {
-	FILE *fp;
-	uint8_t *flash_dump = NULL;
+	FILE *fp = NULL;
 	uint32_t saveidx_slots[2] = {UINT32_MAX, UINT32_MAX};
-	uint32_t sections_slot2[SAVEDATA_NUM_SECTIONS];
+	int slotState[2];
+	int slotOrder[2];
+	int loaded = 0;
 	int hasPokedex = 0;
 
-	flash_dump = malloc(0x20000); // 128 kiB, too big for stack
-
 	savedata_file = filename;
 	if (filename) {
-		fp = fopen(filename, "rb");
+		// The footer scan is 28 small reads, so a whole-cluster buffer would waste time
+		fp = sd_fopen(filename, "rb", SD_FILE_RANDOM);
 		if (!fp) {
 			iprintf("Error opening save file:\n%s\n", filename);
-			free(flash_dump);
 			return 0;
 		}
 
@@ -246,46 +296,69 @@ int load_savedata(const char *filename) {
 		// 1C000-1DFFF Hall of Fame
 		// 1E000-1EFFF Mystery Gift
 		// 1F000-1FFFF Vs Recorder
-		if (fread(flash_dump, 1, 0x20000, fp) < 0x1c000) {
+		if (fseek(fp, 0, SEEK_END) != 0 || ftell(fp) < 0x1c000) {
 			iprintf("This isn't a valid save file.\n");
-			free(flash_dump);
 			fclose(fp);
 			return 0;
 		}
-		fclose(fp);
 	} else {
-		if (!readSlot2Save(flash_dump)) {
-			iprintf("%s", flash_dump);
-			free(flash_dump);
+		const struct gba_flash_chip *chip = gba_flash_init();
+		if (chip)
+			iprintf("Flash chip: %s\n", chip->name);
+		else
+			iprintf("Unknown flash chip, saving will be slow\n");
+	}
+
+	// Pick the most recent slot from the footers alone, then only read that one
+	for (int slotIdx = 0; slotIdx < 2; slotIdx++)
+		slotState[slotIdx] = read_slot_footers(fp, slotIdx, &saveidx_slots[slotIdx]);
+	if (slotState[0] <= 0 && slotState[1] <= 0) {
+		if (slotState[0] == 0 && slotState[1] == 0)
+			iprintf("Save file appears to be uninitialized.\n");
+		else
+			iprintf("Neither save slot is complete.\n");
+		if (fp)
+			fclose(fp);
+		return 0;
+	}
+	// This overflow comparison makes UINT32_MAX compare less than any valid value
+	slotOrder[0] = (slotState[0] > 0 && saveidx_slots[0] + 1 > saveidx_slots[1] + 1) ? 0 : 1;
+	if (slotState[slotOrder[0]] <= 0)
+		slotOrder[0] = !slotOrder[0];
+	slotOrder[1] = !slotOrder[0];
+
+	// Reading a slot is one long run, which goes faster with a bigger buffer
+	if (fp) {
+		fp = sd_freopen(filename, "rb", fp, SD_FILE_SEQUENTIAL);
+		if (!fp) {
+			iprintf("Error opening save file:\n%s\n", filename);
 			return 0;
 		}
 	}
-	for (int slotIdx = 0; slotIdx < 2; slotIdx++) {
-		uint8_t *savedata = flash_dump + slotIdx * sizeof(savedata_buffer);
-		uint32_t *sections = slotIdx ? sections_slot2 : savedata_sections;
-		if (!verify_savedata_slot(savedata, sections, &saveidx_slots[slotIdx])) {
-			free(flash_dump);
-			return 0;
+
+	for (int i = 0; i < 2 && !loaded; i++) {
+		int slotIdx = slotOrder[i];
+		uint32_t saveidx;
+		if (slotState[slotIdx] <= 0)
+			continue;
+		if (i)
+			iprintf("Trying the older save slot\n");
+		if (!read_save_range(fp, savedata_buffer, slotIdx * sizeof(savedata_buffer),
+			sizeof(savedata_buffer))) {
+			iprintf("Error reading save slot %d\n", slotIdx + 1);
+			continue;
 		}
+		if (!verify_slot(savedata_buffer, savedata_sections, section_sums, &saveidx))
+			continue;
+		savedata_active_slot = slotIdx;
+		savedata_index = saveidx;
+		loaded = 1;
 	}
-	if (saveidx_slots[0] == UINT32_MAX && saveidx_slots[1] == UINT32_MAX) {
-		iprintf("Save file appears to be uninitialized.\n");
-		free(flash_dump);
+	if (fp)
+		fclose(fp);
+	if (!loaded)
 		return 0;
-	} else if (saveidx_slots[0] + 1 > saveidx_slots[1] + 1) {
-		// The first savedata slot is more recent.
-		// This overflow comparison makes UINT32_MAX compare less than any valid value
-		memcpy(savedata_buffer, flash_dump, sizeof(savedata_buffer));
-		savedata_active_slot = 0;
-		savedata_index = saveidx_slots[0];
-	} else {
-		// The second savedata slot is more recent.
-		memcpy(savedata_buffer, flash_dump + sizeof(savedata_buffer), sizeof(savedata_buffer));
-		memcpy(savedata_sections, sections_slot2, sizeof(savedata_sections));
-		savedata_active_slot = 1;
-		savedata_index = saveidx_slots[1];
-	}
-	free(flash_dump);
+	savedata_dirty_sections = 0;
 
 	// Make sure the Pokedex is obtained
 	if (IS_RUBY_SAPPHIRE) {
@@ -302,24 +375,6 @@ int load_savedata(const char *filename) {
 	return 1;
 }
 
-void update_section_checksum(int sectionIdx) {
-	uint32_t checksum = 0;
-	uint8_t *section = GET_SAVEDATA_SECTION(sectionIdx);
-	union SaveSlotFooter *footer;
-
-	// Footer is the last 16 bytes of each section
-	footer = ((union SaveSlotFooter*) (section + 0xFF0));
-
-	// Calculate checksum
-	for (long wordIdx = 0; wordIdx < 0xFF0 / 4; wordIdx++) {
-		uint32_t word = GET32(section, wordIdx * 4);
-		checksum += word;
-	}
-	checksum = (checksum & 0xFFFF) + (checksum >> 16);
-	checksum &= 0xFFFF;
-	footer->checksum = (uint16_t) checksum;
-}
-
 int write_savedata(void) {
 	int success = 1;
 	uint32_t seek;
@@ -329,6 +384,8 @@ int write_savedata(void) {
 		union SaveSlotFooter *footer =
 			(union SaveSlotFooter*) (GET_SAVEDATA_SECTION(sectionIdx) + 0xFF0);
 		footer->saveidx = savedata_index + 1;
+		if (savedata_dirty_sections & (1 << sectionIdx))
+			update_section_checksum(sectionIdx);
 	}
 
 	// If the latest save data is in slot 0, write to slot 1, and vice-versa.
@@ -337,7 +394,7 @@ int write_savedata(void) {
 	if (savedata_file) {
 		FILE *fp;
 		int rc;
-		fp = fopen(savedata_file, "r+b");
+		fp = sd_fopen(savedata_file, "r+b", SD_FILE_SEQUENTIAL);
 		fseek(fp, savedata_active_slot ? 0 : 0xE000, SEEK_SET);
 		rc = fwrite(savedata_buffer, 1, sizeof(savedata_buffer), fp);
 		if (rc < sizeof(savedata_buffer)) {
@@ -346,9 +403,19 @@ int write_savedata(void) {
 		}
 		fclose(fp);
 	} else {
-		success = writeSlot2Save(savedata_buffer, seek, sizeof(savedata_buffer));
+		success = gba_flash_write(savedata_buffer, seek, sizeof(savedata_buffer));
+		iprintf("Wrote %lu bytes in %lu ms\n",
+			(unsigned long) gba_flash_stats.writeBytes,
+			(unsigned long) gba_flash_ticks_to_ms(gba_flash_stats.writeTicks));
+		if (gba_flash_stats.sectorsSkipped)
+			iprintf("Unchanged sectors: %u\n", gba_flash_stats.sectorsSkipped);
+		if (gba_flash_stats.timeouts)
+			iprintf("Flash timeouts: %u\n", gba_flash_stats.timeouts);
 	}
 
+	if (success)
+		savedata_dirty_sections = 0;
+
 	// Don't swap the slots or increment the index again in the same session
 	return success;
 }
@@ -377,7 +444,55 @@ int load_box_savedata(uint8_t *box_data, int boxIdx) {
 	return boxIdx;
 }
 
+// Number of Pokemon of each species in the PC, not counting eggs. Indexed by Dex number - 1
+static uint16_t pc_species_counts[386];
+// Set when a deposit brings a species into the PC that may not be registered yet
+static int pc_species_added;
+
+static uint16_t pc_dex_number(const pkm3_t *pkm) {
+	if (PKM3_IS_EGG(*pkm))
+		return 0;
+	return gen3_index_to_pokedex(pkm->species);
+}
+
+static void count_pc_species(const uint8_t *box_data) {
+	pkm3_t pkms[30];
+
+	memset(pc_species_counts, 0, sizeof(pc_species_counts));
+	for (int boxIdx = 0; boxIdx < 14; boxIdx++) {
+		decode_pkm_batch(pkms, NULL, box_data + boxIdx * BOX_SIZE_BYTES_3, PKM3_SIZE, 30);
+		for (int i = 0; i < 30; i++) {
+			uint16_t dexnum = pc_dex_number(&pkms[i]);
+			if (dexnum)
+				pc_species_counts[dexnum - 1]++;
+		}
+	}
+	// Anything already in the PC still gets registered by the first save
+	pc_species_added = 1;
+}
+
+/**
+ * Keeps the PC species counts up to date when a Pokemon is deposited into
+ * (delta 1) or withdrawn from (delta -1) the cartridge's PC boxes.
+ */
+void pokedex_track_pkm(const uint8_t *pkm, int delta) {
+	pkm3_t decoded;
+	uint16_t dexnum;
+
+	if (pkm3_classify_slot(pkm) == PKM3_SLOT_EMPTY)
+		return;
+	decode_pkm_encrypted_data(&decoded, pkm);
+	dexnum = pc_dex_number(&decoded);
+	if (!dexnum)
+		return;
+	// Only a species new to the PC can be missing from the Pokedex
+	if (pc_species_counts[dexnum - 1] == 0 && delta > 0)
+		pc_species_added = 1;
+	pc_species_counts[dexnum - 1] += delta;
+}
+
 int load_boxes_savedata(uint8_t *box_data) {
+	uint8_t *box_data_start = box_data;
 	uint16_t activeBox;
 
 	// First 4 bytes of PC buffer is the most recently viewed PC box number
@@ -396,70 +511,86 @@ int load_boxes_savedata(uint8_t *box_data) {
 	// Section 13 has the last 0x744 bytes of Pokemon data, adding up to 33600 bytes total
 	memcpy(box_data, GET_SAVEDATA_SECTION(13), 0x744);
 
+	count_pc_species(box_data_start);
+
 	return activeBox;
 }
 
+/**
+ * Finds the personality of the first non-egg Pokemon of a species in the PC.
+ */
+static uint32_t find_pc_personality(const uint8_t *box_data, uint16_t dexnum) {
+	pkm3_t pkms[30];
+	for (int boxIdx = 0; boxIdx < 14; boxIdx++) {
+		decode_pkm_batch(pkms, NULL, box_data + boxIdx * BOX_SIZE_BYTES_3, PKM3_SIZE, 30);
+		for (int i = 0; i < 30; i++) {
+			if (pc_dex_number(&pkms[i]) == dexnum)
+				return pkms[i].personality;
+		}
+	}
+	return 0;
+}
+
 static int register_boxes_to_pokedex(const uint8_t *box_data) {
 	uint8_t pokedex[386/8+1] = {0};
-	pkm3_t pkm;
 	int addedEntries = 0;
 	uint32_t unownPersonality = 0;
 	uint32_t spindaPersonality = 0;
-	uint8_t *saveDexOwn, *saveDexSeen1, *saveDexSeen2, *saveDexSeen3;
+	const uint8_t *saveDexOwn;
+	uint32_t dexSeen2Offset, dexSeen3Offset;
+
+	// Nothing can be missing from the Pokedex unless a new species was deposited
+	if (!pc_species_added)
+		return 0;
+	pc_species_added = 0;
 
 	// Get the list of all species that exist in the PC boxes
-	for (int i = 0; i < 14 * 30; i++) {
-		uint16_t dexnum;
-		decode_pkm_encrypted_data(&pkm, box_data + i * PKM3_SIZE);
-		dexnum = gen3_index_to_pokedex(pkm.species);
-		// Ignore eggs
-		if (PKM3_IS_EGG(pkm))
-			continue;
-		if (dexnum == 201 && !unownPersonality)
-			unownPersonality = pkm.personality;
-		if (dexnum == 327 && !spindaPersonality)
-			spindaPersonality = pkm.personality;
-		if (dexnum) {
-			dexnum--;
+	for (int dexnum = 0; dexnum < 386; dexnum++) {
+		if (pc_species_counts[dexnum])
 			pokedex[dexnum / 8] |= 1 << (dexnum & 7);
-		}
 	}
-
-	// Get pointers to all the Own and Seen lists based on which game is in use
 	saveDexOwn = GET_SAVEDATA_SECTION(0) + 0x28;
-	saveDexSeen1 = GET_SAVEDATA_SECTION(0) + 0x5C;
+	if (pc_species_counts[201 - 1] && (saveDexOwn[(201-1)/8] & (1 << ((201-1) & 7))) == 0)
+		unownPersonality = find_pc_personality(box_data, 201);
+	if (pc_species_counts[327 - 1] && (saveDexOwn[(327-1)/8] & (1 << ((327-1) & 7))) == 0)
+		spindaPersonality = find_pc_personality(box_data, 327);
 
+	// Get the offsets of all the Own and Seen lists based on which game is in use
+	// Own is at section 0 + 0x28 and the first Seen list is at section 0 + 0x5C
 	if (IS_RUBY_SAPPHIRE) {
-		saveDexSeen2 = GET_SAVEDATA_SECTION(1) + 0x938;
-		saveDexSeen3 = GET_SAVEDATA_SECTION(4) + 0xC0C;
+		dexSeen2Offset = 0x938;
+		dexSeen3Offset = 0xC0C;
 		// Unlock the National Dex
-		GET_SAVEDATA_SECTION(0)[0x19] = 1;
-		GET_SAVEDATA_SECTION(0)[0x1A] = 0xDA;
-		GET_SAVEDATA_SECTION(2)[0x3A6] |= 0x40;
-		SET16(GET_SAVEDATA_SECTION(2), 0x44C) = 0x302;
+		savedata_write8(0, 0x19, 1);
+		savedata_write8(0, 0x1A, 0xDA);
+		savedata_write8(2, 0x3A6, GET_SAVEDATA_SECTION(2)[0x3A6] | 0x40);
+		savedata_write16(2, 0x44C, 0x302);
 	} else if (IS_EMERALD) {
-		saveDexSeen2 = GET_SAVEDATA_SECTION(1) + 0x988;
-		saveDexSeen3 = GET_SAVEDATA_SECTION(4) + 0xCA4;
+		dexSeen2Offset = 0x988;
+		dexSeen3Offset = 0xCA4;
 	} else /* IS_FIRERED_LEAFGREEN */ {
-		saveDexSeen2 = GET_SAVEDATA_SECTION(1) + 0x5F8;
-		saveDexSeen3 = GET_SAVEDATA_SECTION(4) + 0xB98;
+		dexSeen2Offset = 0x5F8;
+		dexSeen3Offset = 0xB98;
 	}
 
 	// Save the forms for Unown (#201) and Spinda (#327) if not already owned
 	if (unownPersonality && (saveDexOwn[(201-1)/8] & (1 << ((201-1) & 7))) == 0)
-		SET32(GET_SAVEDATA_SECTION(0), 0x1C) = unownPersonality;
+		savedata_write32(0, 0x1C, unownPersonality);
 	if (spindaPersonality && (saveDexOwn[(327-1)/8] & (1 << ((327-1) & 7))) == 0)
-		SET32(GET_SAVEDATA_SECTION(0), 0x20) = spindaPersonality;
+		savedata_write32(0, 0x20, spindaPersonality);
 
 	// Add each Pokemon to all the Own and Seen lists
 	for (int dexByteIdx = 0; dexByteIdx < sizeof(pokedex); dexByteIdx++) {
 		uint8_t dexByte = pokedex[dexByteIdx];
 		uint8_t addingBits = dexByte & ~(saveDexOwn[dexByteIdx]);
 		if (addingBits) {
-			saveDexOwn[dexByteIdx] |= dexByte;
-			saveDexSeen1[dexByteIdx] |= dexByte;
-			saveDexSeen2[dexByteIdx] |= dexByte;
-			saveDexSeen3[dexByteIdx] |= dexByte;
+			savedata_write8(0, 0x28 + dexByteIdx, saveDexOwn[dexByteIdx] | dexByte);
+			savedata_write8(0, 0x5C + dexByteIdx,
+				GET_SAVEDATA_SECTION(0)[0x5C + dexByteIdx] | dexByte);
+			savedata_write8(1, dexSeen2Offset + dexByteIdx,
+				GET_SAVEDATA_SECTION(1)[dexSeen2Offset + dexByteIdx] | dexByte);
+			savedata_write8(4, dexSeen3Offset + dexByteIdx,
+				GET_SAVEDATA_SECTION(4)[dexSeen3Offset + dexByteIdx] | dexByte);
 			// Count how many Pokemon weren't already marked as owned
 			while (addingBits) {
 				if ((addingBits & 1))
@@ -468,10 +599,6 @@ static int register_boxes_to_pokedex(const uint8_t *box_data) {
 			}
 		}
 	}
-	update_section_checksum(0);
-	update_section_checksum(2);
-	update_section_checksum(1);
-	update_section_checksum(4);
 	return addedEntries;
 }
 
@@ -483,18 +610,13 @@ int write_boxes_savedata(uint8_t *box_data) {
 	if (rc)
 		iprintf("%d Pokemon added to the Pokedex\n", rc);
 
-	memcpy(GET_SAVEDATA_SECTION(5) + 4, box_data, 0xf7c);
+	savedata_write(5, 4, box_data, 0xf7c);
 	box_data += 0xf7c;
 	for (int section = 6; section <= 12; section++) {
-		memcpy(GET_SAVEDATA_SECTION(section), box_data, 0xf80);
+		savedata_write(section, 0, box_data, 0xf80);
 		box_data += 0xf80;
 	}
-	memcpy(GET_SAVEDATA_SECTION(13), box_data, 0x744);
-
-	// Recalculate checksum for all box sections
-	for (int section = 5; section <= 13; section++) {
-		update_section_checksum(section);
-	}
+	savedata_write(13, 0, box_data, 0x744);
 
 	return 1;
 }
@@ -547,11 +669,11 @@ void pkm3_to_simplepkm(struct SimplePKM *simple, const uint8_t *src) {
 	pkm3_t pkm;
 	uint16_t checksum;
 
-	checksum = decode_pkm_encrypted_data(&pkm, src);
-
-	if (pkm.species == 0)
+	if (pkm3_classify_slot(src) == PKM3_SLOT_EMPTY)
 		return;
 
+	checksum = decode_pkm_encrypted_data(&pkm, src);
+
 	decode_gen3_string16(simple->nickname, pkm.nickname, 10, pkm.language);
 	decode_gen3_string16(simple->trainerName, pkm.trainerName, 7, pkm.language);
 
@@ -601,7 +723,6 @@ void pkm3_to_simplepkm(struct SimplePKM *simple, const uint8_t *src) {
 
 	// Calculate stats
 	if (baseStats->expGrowth <= 5) {
-		const uint32_t *growthTable;
 		uint8_t level;
 		uint8_t nature;
 		uint8_t natureMods[6] = {10, 10, 10, 10, 10, 10};
@@ -609,11 +730,7 @@ void pkm3_to_simplepkm(struct SimplePKM *simple, const uint8_t *src) {
 		simple->nature = nature;
 		natureMods[nature / 5 + 1]++;
 		natureMods[nature % 5 + 1]--;
-		growthTable = experienceTables[baseStats->expGrowth];
-		for (level = 0; level < 100; level++) {
-			if (pkm.experience < growthTable[level])
-				break;
-		}
+		level = gen3_exp_to_level(baseStats->expGrowth, pkm.experience, NULL);
 		simple->level = level;
 		for (int statIdx = 0; statIdx < 6; statIdx++) {
 			uint8_t iv = pkm.IVs >> (5 * statIdx) & 0x1F;
@@ -670,59 +787,142 @@ void print_trainer_info() {
 		1000 * (int) trainerInfo[0x12] / 60);
 }
 
-uint16_t decode_pkm_encrypted_data(pkm3_t *dest, const uint8_t *src) {
-	/* There are 4 pkm data sections that can be permutated in any order
-	 * depending on the personality value.
-	 * data_order[] encodes each possible ordering as one byte, made up of
-	 * four 2-bit fields corresponding to the index of each section.
-	 * For example, with 0x93 == 0b10010011
-	 *   bits[1:0] == 0b11 => reordered section 0 is copied from source section 3
-	 *   bits[3:2] == 0b00 => reordered section 1 is copied from source section 0
-	 *   bits[5:4] == 0b01 => reordered section 2 is copied from source section 1
-	 *   bits[7:6] == 0b10 => reordered section 3 is copied from source section 2
-	 *
-	 * When reordered, these four sections are:
-	 *   0. Growth: species, held item, exp, friendship
-	 *   1. Attacks: currently-learned moveset and PP limits
-	 *   2. EVs and Contest Condition
-	 *   3. Misc: IVs, ability, ribbons, pokerus, and met/origin data
-	 */
-	static const uint8_t data_order[] = {
-		0xe4, 0xb4, 0xd8, 0x9c, 0x78, 0x6c,
-		0xe1, 0xb1, 0xd2, 0x93, 0x72, 0x63,
-		0xc9, 0x8d, 0xc6, 0x87, 0x4e, 0x4b,
-		0x39, 0x2d, 0x36, 0x27, 0x1e, 0x1b
-		// Same numbers as above but in binary
-		//0b11100100, 0b10110100, 0b11011000, 0b10011100, 0b01111000, 0b01101100,
-		//0b11100001, 0b10110001, 0b11010010, 0b10010011, 0b01110010, 0b01100011,
-		//0b11001001, 0b10001101, 0b11000110, 0b10000111, 0b01001110, 0b01001011,
-		//0b00111001, 0b00101101, 0b00110110, 0b00100111, 0b00011110, 0b00011011
-	};
-	uint16_t checksum;
-	uint8_t order;
-	uint32_t xor;
-	uint8_t reordered[48];
+/* There are 4 pkm data sections that can be permutated in any order
+ * depending on the personality value.
+ * data_order[] encodes each possible ordering as one byte, made up of
+ * four 2-bit fields corresponding to the index of each section.
+ * For example, with 0x93 == 0b10010011
+ *   bits[1:0] == 0b11 => reordered section 0 is copied from source section 3
+ *   bits[3:2] == 0b00 => reordered section 1 is copied from source section 0
+ *   bits[5:4] == 0b01 => reordered section 2 is copied from source section 1
+ *   bits[7:6] == 0b10 => reordered section 3 is copied from source section 2
+ *
+ * When reordered, these four sections are:
+ *   0. Growth: species, held item, exp, friendship
+ *   1. Attacks: currently-learned moveset and PP limits
+ *   2. EVs and Contest Condition
+ *   3. Misc: IVs, ability, ribbons, pokerus, and met/origin data
+ */
+static const uint8_t data_order[] = {
+	0xe4, 0xb4, 0xd8, 0x9c, 0x78, 0x6c,
+	0xe1, 0xb1, 0xd2, 0x93, 0x72, 0x63,
+	0xc9, 0x8d, 0xc6, 0x87, 0x4e, 0x4b,
+	0x39, 0x2d, 0x36, 0x27, 0x1e, 0x1b
+	// Same numbers as above but in binary
+	//0b11100100, 0b10110100, 0b11011000, 0b10011100, 0b01111000, 0b01101100,
+	//0b11100001, 0b10110001, 0b11010010, 0b10010011, 0b01110010, 0b01100011,
+	//0b11001001, 0b10001101, 0b11000110, 0b10000111, 0b01001110, 0b01001011,
+	//0b00111001, 0b00101101, 0b00110110, 0b00100111, 0b00011110, 0b00011011
+};
 
-	// Rearrange to a consistent order
-	order = data_order[GET32(src, 0) % 24];
-	for (int i = 0; i < 4; i++)
-		memcpy(reordered + i * 12, src + 32 + 12 * ((order >> (i * 2)) & 3), 12);
+/**
+ * Decodes one 80-byte record in a single pass over its 32-bit words:
+ * each word is read from its shuffled position, XORed, and added to the
+ * checksum. Both src and dest must be word-aligned. Returns the checksum of
+ * the decrypted data, which only matches dest->checksum for a valid record.
+ */
+static inline uint16_t decode_pkm_words(uint32_t *dest, const uint32_t *src) {
+	uint32_t personality = src[0];
+	uint32_t xor = personality ^ src[1];
+	uint8_t order = data_order[personality % 24];
+	uint32_t checksum = 0;
 
-	// "Decrypt" the reordered data
-	xor = GET32(src, 0) ^ GET32(src, 4);
-	for (int i = 0; i < 48; i += 4) {
-		SET32(reordered, i) ^= xor;
+	for (int i = 0; i < 8; i++)
+		dest[i] = src[i];
+	for (int i = 0; i < 4; i++, order >>= 2) {
+		const uint32_t *block = src + 8 + 3 * (order & 3);
+		uint32_t *out = dest + 8 + 3 * i;
+		for (int j = 0; j < 3; j++) {
+			uint32_t word = block[j] ^ xor;
+			out[j] = word;
+			// Adding both halfwords at once: only the low 16 bits are kept
+			checksum += word + (word >> 16);
+		}
+	}
+	return (uint16_t) checksum;
+}
+
+/**
+ * Inverse of decode_pkm_words. Also stores the checksum in the header.
+ */
+static inline uint16_t encode_pkm_words(uint32_t *dest, const uint32_t *src) {
+	uint32_t personality = src[0];
+	uint32_t xor = personality ^ src[1];
+	uint8_t order = data_order[personality % 24];
+	uint32_t checksum = 0;
+
+	for (int i = 0; i < 4; i++, order >>= 2) {
+		const uint32_t *block = src + 8 + 3 * i;
+		uint32_t *out = dest + 8 + 3 * (order & 3);
+		for (int j = 0; j < 3; j++) {
+			uint32_t word = block[j];
+			out[j] = word ^ xor;
+			checksum += word + (word >> 16);
+		}
 	}
+	for (int i = 0; i < 8; i++)
+		dest[i] = src[i];
+	// The checksum is the low half of word 7
+	dest[7] = (dest[7] & 0xFFFF0000) | (uint16_t) checksum;
+	return (uint16_t) checksum;
+}
+
+/**
+ * Decrypts only the first word of the Growth section, which holds the species.
+ */
+static inline uint16_t decode_pkm_species(const uint32_t *src) {
+	uint32_t personality = src[0];
+	uint8_t order = data_order[personality % 24];
+	return (uint16_t) (src[8 + 3 * (order & 3)] ^ personality ^ src[1]);
+}
+
+/**
+ * Classifies a box slot from its header and a single decrypted word.
+ * A slot is empty exactly when its decrypted species is 0, the same test the
+ * full decode would give.
+ */
+enum Pkm3SlotState pkm3_classify_slot(const uint8_t *src) {
+	const uint32_t *words = (const uint32_t*) src;
+	// Byte 0x13 holds the flags: bit 0 is set for Bad Eggs
+	uint8_t flags = src[0x13];
+
+	if (decode_pkm_species(words) == 0)
+		return PKM3_SLOT_EMPTY;
+	if (flags & 1)
+		return PKM3_SLOT_CORRUPT;
+	return PKM3_SLOT_VALID;
+}
 
-	// Calculate the checksum
-	checksum = 0;
-	for (int i = 0; i < 48; i += 2)
-		checksum += GET16(reordered, i);
+uint16_t decode_pkm_encrypted_data(pkm3_t *dest, const uint8_t *src) {
+	pkm3_t tmp;
+	if (!dest)
+		dest = &tmp;
+	return decode_pkm_words(dest->words, (const uint32_t*) src);
+}
 
-	// Output result data
-	if (dest) {
-		memcpy(dest->bytes, src, 32);
-		memcpy(dest->bytes + 32, reordered, 48);
+uint16_t encode_pkm_encrypted_data(uint8_t *dest, const pkm3_t *src) {
+	return encode_pkm_words((uint32_t*) dest, src->words);
+}
+
+/**
+ * Decodes count records spaced stride bytes apart, such as a whole box or
+ * the whole PC. checksums may be NULL.
+ * Empty slots aren't decoded; they come out as all zeroes with a checksum of 0.
+ */
+void decode_pkm_batch(pkm3_t *dest, uint16_t *checksums, const uint8_t *src,
+	size_t stride, int count) {
+	for (int i = 0; i < count; i++, src += stride) {
+		uint16_t checksum = 0;
+		if (pkm3_classify_slot(src) == PKM3_SLOT_EMPTY)
+			memset(dest[i].words, 0, sizeof(dest[i].words));
+		else
+			checksum = decode_pkm_words(dest[i].words, (const uint32_t*) src);
+		if (checksums)
+			checksums[i] = checksum;
 	}
-	return checksum;
+}
+
+void encode_pkm_batch(uint8_t *dest, size_t stride, const pkm3_t *src, int count) {
+	for (int i = 0; i < count; i++, dest += stride)
+		encode_pkm_words((uint32_t*) dest, src[i].words);
 }
@@ -30,6 +30,7 @@
 
 union pkm_t {
 	uint8_t bytes[80];
+	uint32_t words[20]; // Also keeps every pkm3_t word-aligned
 	struct {
 		uint32_t personality;
 		uint32_t trainerId;
@@ -64,19 +65,36 @@ typedef union pkm_t pkm3_t;
 
 struct SimplePKM;
 
+enum Pkm3SlotState {
+	PKM3_SLOT_EMPTY,
+	/* Occupied. The checksum is only known after a full decode */
+	PKM3_SLOT_VALID,
+	/* Occupied, but the game already flagged it as a Bad Egg */
+	PKM3_SLOT_CORRUPT
+};
+
 #define PKM3_IS_EGG(pkm) ((pkm).IVs >> 30 & 1)
 
 extern uint8_t savedata_buffer[SAVEDATA_NUM_SECTIONS * 0x1000]; // 56 kiB
 extern uint32_t savedata_sections[SAVEDATA_NUM_SECTIONS];
 extern int savedata_active_slot;
+extern uint16_t savedata_dirty_sections; // Sections modified since loading or the last write
 
 void pkm3_to_simplepkm(struct SimplePKM *simple, const uint8_t *src);
 int pkm_is_shiny(const union pkm_t *pkm);
 uint16_t pkm_displayed_species(const union pkm_t *pkm);
 void print_trainer_info(void);
 uint16_t decode_pkm_encrypted_data(pkm3_t *dest, const uint8_t *src);
+uint16_t encode_pkm_encrypted_data(uint8_t *dest, const pkm3_t *src);
+enum Pkm3SlotState pkm3_classify_slot(const uint8_t *src);
+void decode_pkm_batch(pkm3_t *dest, uint16_t *checksums, const uint8_t *src,
+	size_t stride, int count);
+void encode_pkm_batch(uint8_t *dest, size_t stride, const pkm3_t *src, int count);
+int verify_savedata_slot(const uint8_t *savedata, uint32_t *sections_out, uint32_t *saveidx_out);
 int load_box_savedata(uint8_t *box_data, int boxIdx);
 int load_boxes_savedata(uint8_t *box_data);
+void pokedex_track_pkm(const uint8_t *pkm, int delta);
 int write_boxes_savedata(uint8_t *box_data);
 int load_savedata(const char *filename);
+void savedata_write(int sectionIdx, uint32_t offset, const void *data, uint32_t size);
 int write_savedata(void);
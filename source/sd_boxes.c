@@ -19,19 +19,58 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 
+#include "crc32.h"
 #include "message_window.h"
 #include "pkmx_format.h"
+#include "sd_file.h"
+#include "sd_groups.h"
+#include "sd_search.h"
 #include "util.h"
 
 #define BOXDATA_MAGIC "PKMBBOXG"
+#define BOXDATA_VERSION 1
+
+// Each group is in SD_BOXES_DIR/groupNNN.bin, with NNN the group number
+#define GROUP_PATH_SIZE sizeof(SD_BOXES_DIR "/group000.bin")
+// Version 0 files are converted on open by writing a .new file and renaming it
+#define GROUP_EXT ".bin"
+#define GROUP_EXT_NEW ".new"
+
+#define MAX_BOXES 255
 
 #if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
 #error "Only little-endian is supported."
 #endif
 
+/* Version 0 files have a slot header, all the box metadata, and all the
+ * PKMX data in each of two slots, and every save rewrites a whole slot.
+ *
+ * Version 1 files keep two records for every box instead:
+ *   boxg_file_header
+ *   Directory 1 at sizeof(boxg_file_header), directory 2 at slot2Offset, each
+ *     a boxg_slot_header followed by a boxg_box_entry for up to 255 boxes
+ *   Box records after directory 2, with copy C of box N at
+ *     BOX_RECORD_OFFSET(N, C). Each is a boxg_box_header and 30 PKMX,
+ *     packed with pack_box if that makes them smaller.
+ * A save writes each changed box over the copy that the active directory
+ * doesn't use, writes the new directory to the inactive directory slot, and
+ * only then flips activeSlot in the file header. Until the flip, nothing the
+ * active directory refers to has been touched.
+ *
+ * Each directory carries a CRC32 of itself, and each directory entry a CRC32
+ * of the box record it points to. If the active directory is damaged the
+ * loader uses the other one, and a damaged box falls back to the copy the
+ * other directory points to.
+ *
+ * The file stays open between sd_boxes_open and sd_boxes_close, and boxes are
+ * read and written one at a time. Written boxes are staged in their inactive
+ * copies and only become part of the file at sd_boxes_commit, so closing
+ * without a commit leaves the file as it was.
+ */
 struct boxg_file_header {
 	char magic[8]; // PKMBBOXG
 	uint16_t version;
@@ -43,7 +82,7 @@ struct boxg_file_header {
 
 struct boxg_slot_header {
 	uint32_t saveCounter;
-	uint32_t checksum; // unused
+	uint32_t checksum; // CRC32 of the directory with this field zeroed, version 1 only
 	uint32_t timestamp; // unused
 	uint16_t timestamp_msb; // 48-bit timestamp avoids Y2038, but NDS RTC only goes to 2099
 	uint16_t numBoxes;
@@ -55,148 +94,393 @@ struct boxg_boxmeta {
 	uint16_t boxName[14]; // UCS-2LE encoding
 };
 
-int sd_boxes_load(uint8_t *boxData, uint8_t group, uint8_t *numBoxes_out) {
+struct boxg_box_entry {
+	uint32_t saveCounter; // The save that last wrote this box, 0 if never written
+	uint32_t checksum; // CRC32 of the whole box record
+	uint8_t copy; // Which of the two records is current
+	uint8_t numPokemon; // Occupied slots, so group info doesn't need to read boxes
+	uint16_t dataSize; // Bytes after the box header, 0 for an unpacked box
+};
+
+struct boxg_box_header {
+	uint32_t saveCounter; // Must match the directory entry
+	uint16_t boxIdx;
+	uint8_t encoding; // BOX_ENCODING_*
+	uint8_t unused;
+	struct boxg_boxmeta meta;
+};
+
+#define BOX_ENCODING_RAW 0
+#define BOX_ENCODING_PACKED 1
+
+#define DIRECTORY_SIZE (sizeof(struct boxg_slot_header) + MAX_BOXES * sizeof(struct boxg_box_entry))
+#define SLOT2_OFFSET (sizeof(struct boxg_file_header) + DIRECTORY_SIZE)
+#define BOX_RECORD_SIZE (sizeof(struct boxg_box_header) + 30 * PKMX_SIZE)
+#define BOX_RECORD_OFFSET(box, copy) \
+	(SLOT2_OFFSET + DIRECTORY_SIZE + (2 * (box) + (copy)) * BOX_RECORD_SIZE)
+
+uint32_t sd_boxes_bytes_written;
+
+// The open group file. NULL if the group has no file yet.
+static FILE *group_fp = NULL;
+static uint8_t group_number;
+static struct boxg_file_header file_header;
+
+// Both directories of the file, too big for the stack
+static struct boxg_slot_header dir_headers[2];
+static struct boxg_box_entry dir_entries[2][MAX_BOXES];
+// The directory boxes are read from, and whether the other one can be a fallback
+static uint8_t base_slot;
+static int backup_valid;
+
+// The directory the next commit writes: the base directory plus staged boxes
+static struct boxg_slot_header work_header;
+static struct boxg_box_entry work_entries[MAX_BOXES];
+// One bit per box written since the last commit
+static uint8_t staged_boxes[(MAX_BOXES + 7) / 8];
+// Search index entries of each staged box, made while the box is unpacked
+// and written to the index after the commit. If any couldn't be allocated,
+// the index is left for a search to rebuild.
+static struct sd_search_entry *staged_entries[MAX_BOXES];
+static uint8_t staged_entries_lost;
+
+// Scratch directory for reading the info of groups other than the open one
+static struct boxg_box_entry info_entries[MAX_BOXES];
+// Scratch box for reading boxes back into the search index
+static uint8_t scan_box[30 * PKMX_SIZE];
+// A box record's data as it is in the file, when it's packed
+static uint8_t pack_buffer[30 * PKMX_SIZE];
+
+static void group_file_path(char *path, uint8_t group, const char *ext) {
+	snprintf(path, GROUP_PATH_SIZE, SD_BOXES_DIR "/group%03u%s", group, ext);
+}
+
+/**
+ * Opens a group file. The open group is read and written one box record at
+ * a time, so it should use SD_FILE_RANDOM. Only whole-file passes like
+ * sd_boxes_scan benefit from SD_FILE_SEQUENTIAL's bigger buffer.
+ */
+static FILE* open_group_file(uint8_t group, const char *mode, enum SdFileAccess access) {
+	char path[GROUP_PATH_SIZE];
+	char pathNew[GROUP_PATH_SIZE];
 	FILE *fp;
-	struct boxg_file_header fileHeader;
-	struct boxg_slot_header slotHeader;
-	size_t rc;
-	uint16_t numBoxes;
-	size_t readSize;
 
-	fp = fopen("/pokebox/boxes/group000.bin", "rb");
-	if (!fp) {
-		if (errno != ENOENT) {
-			fclose(fp);
-			open_message_window("Error loading SD boxes: File open failed (%d)", errno);
-		}
-		// Initialize 32 empty boxes by default
-		*numBoxes_out = 32;
-		return 1;
+	group_file_path(path, group, GROUP_EXT);
+	fp = sd_fopen(path, mode, access);
+	// Finish a conversion that was interrupted after removing the old file
+	if (!fp && errno == ENOENT) {
+		group_file_path(pathNew, group, GROUP_EXT_NEW);
+		if (rename(pathNew, path) == 0)
+			fp = sd_fopen(path, mode, access);
+		else
+			errno = ENOENT;
 	}
+	return fp;
+}
 
-	// Read and validate the file header
-	rc = fread(&fileHeader, 1, sizeof(fileHeader), fp) < sizeof(fileHeader) ||
-		memcmp(fileHeader.magic, BOXDATA_MAGIC, sizeof(fileHeader.magic));
-	if (rc) {
-		fclose(fp);
-		open_message_window("Error loading SD boxes: Invalid file type");
+static int read_file_header(FILE *fp, struct boxg_file_header *fileHeader) {
+	return fseek(fp, 0, SEEK_SET) == 0 &&
+		fread(fileHeader, 1, sizeof(*fileHeader), fp) == sizeof(*fileHeader) &&
+		memcmp(fileHeader->magic, BOXDATA_MAGIC, sizeof(fileHeader->magic)) == 0;
+}
+
+static uint32_t directory_offset(const struct boxg_file_header *fileHeader, uint8_t slot) {
+	return slot ? fileHeader->slot2Offset : sizeof(*fileHeader);
+}
+
+static uint32_t directory_checksum(const struct boxg_slot_header *slotHeader,
+	const struct boxg_box_entry *entries) {
+	struct boxg_slot_header header = *slotHeader;
+	uint32_t crc;
+	header.checksum = 0;
+	crc = crc32((const uint8_t*) &header, sizeof(header), 0);
+	return crc32((const uint8_t*) entries, header.numBoxes * sizeof(*entries), crc);
+}
+
+/**
+ * Reads directory slot 0 or 1 of a file.
+ * Returns 0 if it can't be read, was never written, or fails its checksum.
+ */
+static int read_directory(FILE *fp, const struct boxg_file_header *fileHeader, uint8_t slot,
+	struct boxg_slot_header *slotHeader, struct boxg_box_entry *entries) {
+	memset(slotHeader, 0, sizeof(*slotHeader));
+	if (fseek(fp, directory_offset(fileHeader, slot), SEEK_SET) < 0 ||
+		fread(slotHeader, 1, sizeof(*slotHeader), fp) < sizeof(*slotHeader))
 		return 0;
-	}
-	if (fileHeader.version != 0) {
-		fclose(fp);
-		open_message_window("Error loading SD boxes: Invalid file version");
+	if (slotHeader->saveCounter == 0 || slotHeader->numBoxes > MAX_BOXES)
 		return 0;
-	}
-
-	// Read the slot header
-	if (fileHeader.activeSlot) {
-		fseek(fp, fileHeader.slot2Offset, SEEK_SET);
-	}
-	rc = fread(&slotHeader, 1, sizeof(slotHeader), fp);
-	if (rc < sizeof(slotHeader)) {
-		fclose(fp);
-		open_message_window("Error loading SD boxes: Unexpected EOF");
+	if (fread(entries, sizeof(*entries), slotHeader->numBoxes, fp) < slotHeader->numBoxes)
 		return 0;
+	return directory_checksum(slotHeader, entries) == slotHeader->checksum;
+}
+
+static uint8_t count_box_pokemon(const uint8_t *box) {
+	uint8_t count = 0;
+	for (int i = 0; i < 30; i++) {
+		// The first PKMX byte is the generation, 0 for an empty slot
+		if (box[i * PKMX_SIZE])
+			count++;
 	}
+	return count;
+}
 
-	// Allow files with more than 32 boxes, but ignore boxes 33+
-	numBoxes = slotHeader.numBoxes;
-	if (numBoxes > 32)
-		numBoxes = 32;
-	*numBoxes_out = numBoxes;
+static void fill_group_info(struct sd_group_info *info, uint8_t group,
+	const struct boxg_file_header *fileHeader, const struct boxg_slot_header *slotHeader,
+	const struct boxg_box_entry *entries) {
+	memset(info, 0, sizeof(*info));
+	info->groupNumber = group;
+	info->numBoxes = slotHeader->numBoxes;
+	info->saveCounter = slotHeader->saveCounter;
+	if (fileHeader)
+		memcpy(info->name, fileHeader->groupName, sizeof(info->name));
+	for (uint16_t boxIdx = 0; boxIdx < slotHeader->numBoxes; boxIdx++)
+		info->numPokemon += entries[boxIdx].numPokemon;
+}
 
-	// Ignore the box metadata for now
-	fseek(fp, sizeof(struct boxg_boxmeta) * slotHeader.numBoxes, SEEK_CUR);
+/* Most of a box is zeroes: an empty slot is all zeroes, and a Gen3 PKMX only
+ * uses 84 of its 176 bytes. pack_box replaces runs of zeroes in a box. Each
+ * run of the packed data starts with a control byte c. Below 0x80 it's
+ * followed by c + 1 bytes to copy, and otherwise it stands for (c & 0x7F) + 1
+ * zeroes.
+ */
+#define PACK_RUN_MAX 128
+// Shorter runs of zeroes are cheaper to copy than to end a copy run for
+#define PACK_MIN_ZEROES 3
+
+static uint32_t count_zeroes(const uint8_t *data, uint32_t pos, uint32_t size) {
+	uint32_t count = 0;
+	while (pos + count < size && data[pos + count] == 0 && count < PACK_RUN_MAX)
+		count++;
+	return count;
+}
 
-	// Read the actual PKMX data
-	readSize = PKMX_SIZE * 30 * numBoxes;
-	rc = fread(boxData, 1, readSize, fp);
-	if (rc < readSize) {
-		if (feof(fp))
-			open_message_window("Error loading SD boxes: Unexpected EOF");
-		else
-			open_message_window("Error loading SD boxes: Read error (%d)", errno);
-		fclose(fp);
-		return 0;
+/**
+ * Packs a box into out, which has room for 30 PKMX. Returns the packed size,
+ * or 0 if packing wouldn't make the box smaller.
+ */
+static uint16_t pack_box(uint8_t *out, const uint8_t *box) {
+	const uint32_t size = 30 * PKMX_SIZE;
+	uint32_t pos = 0, outPos = 0;
+
+	while (pos < size) {
+		uint32_t zeroes = count_zeroes(box, pos, size);
+		uint32_t start = pos;
+
+		if (zeroes >= PACK_MIN_ZEROES || (zeroes && pos + zeroes == size)) {
+			if (outPos + 1 >= size)
+				return 0;
+			out[outPos++] = 0x80 | (zeroes - 1);
+			pos += zeroes;
+			continue;
+		}
+		// Copy up to the next run of zeroes worth replacing
+		while (pos < size && pos - start < PACK_RUN_MAX) {
+			if (box[pos] == 0) {
+				zeroes = count_zeroes(box, pos, size);
+				if (zeroes >= PACK_MIN_ZEROES || pos + zeroes == size)
+					break;
+			}
+			pos++;
+		}
+		if (outPos + 1 + (pos - start) >= size)
+			return 0;
+		out[outPos++] = pos - start - 1;
+		memcpy(out + outPos, box + start, pos - start);
+		outPos += pos - start;
 	}
+	return outPos;
+}
 
-	fclose(fp);
-	return 1;
+static int unpack_box(uint8_t *box, const uint8_t *in, uint16_t inSize) {
+	const uint32_t size = 30 * PKMX_SIZE;
+	uint32_t pos = 0, inPos = 0;
+
+	while (inPos < inSize) {
+		uint8_t control = in[inPos++];
+		uint32_t len = (control & 0x7F) + 1;
+
+		if (pos + len > size)
+			return 0;
+		if (control & 0x80) {
+			memset(box + pos, 0, len);
+		} else {
+			if (inPos + len > inSize)
+				return 0;
+			memcpy(box + pos, in + inPos, len);
+			inPos += len;
+		}
+		pos += len;
+	}
+	return pos == size;
 }
 
-static int copy_file_blocks(uint32_t dstOff, uint32_t srcOff, uint32_t size, FILE *fp) {
-	uint8_t buffer[1024];
+/**
+ * Reads the box record an entry points to. Returns 0 on a read error or if
+ * the record doesn't match the entry.
+ */
+static int read_box_record(FILE *fp, uint8_t *box, uint16_t boxIdx,
+	const struct boxg_box_entry *entry) {
+	struct boxg_box_header boxHeader;
+	uint16_t dataSize = entry->dataSize ? entry->dataSize : 30 * PKMX_SIZE;
+	uint8_t *data;
+	uint32_t crc;
 	int rc;
-	while (size > sizeof(buffer)) {
-		rc =
-			fseek(fp, srcOff, SEEK_SET) < 0 ||
-			fread(buffer, 1, sizeof(buffer), fp) < sizeof(buffer) ||
-			fseek(fp, dstOff, SEEK_SET) < 0 ||
-			fwrite(buffer, 1, sizeof(buffer), fp) < sizeof(buffer);
-		if (rc)
+
+	if (dataSize > 30 * PKMX_SIZE)
+		return 0;
+	rc = fseek(fp, BOX_RECORD_OFFSET(boxIdx, entry->copy), SEEK_SET) == 0 &&
+		fread(&boxHeader, 1, sizeof(boxHeader), fp) == sizeof(boxHeader);
+	if (!rc || boxHeader.boxIdx != boxIdx || boxHeader.saveCounter != entry->saveCounter)
+		return 0;
+	data = boxHeader.encoding == BOX_ENCODING_PACKED ? pack_buffer : box;
+	if (fread(data, 1, dataSize, fp) != dataSize)
+		return 0;
+	crc = crc32((const uint8_t*) &boxHeader, sizeof(boxHeader), 0);
+	if (crc32(data, dataSize, crc) != entry->checksum)
+		return 0;
+	if (boxHeader.encoding == BOX_ENCODING_PACKED)
+		return unpack_box(box, data, dataSize);
+	return boxHeader.encoding == BOX_ENCODING_RAW && dataSize == 30 * PKMX_SIZE;
+}
+
+/**
+ * Seeks to offset for writing. If the file is shorter than that, it gets
+ * extended with zeroes first, because seeking past the end isn't portable.
+ */
+static int seek_for_write(FILE *fp, uint32_t offset) {
+	static const uint8_t zeroes[512];
+	long size;
+
+	if (fseek(fp, 0, SEEK_END) < 0 || (size = ftell(fp)) < 0)
+		return 0;
+	while ((uint32_t) size < offset) {
+		uint32_t chunk = offset - size;
+		if (chunk > sizeof(zeroes))
+			chunk = sizeof(zeroes);
+		if (fwrite(zeroes, 1, chunk, fp) < chunk)
 			return 0;
-		size -= sizeof(buffer);
-		srcOff += sizeof(buffer);
-		dstOff += sizeof(buffer);
+		size += chunk;
 	}
-	if (size) {
-		rc =
-			fseek(fp, srcOff, SEEK_SET) < 0 ||
-			fread(buffer, 1, size, fp) < size ||
-			fseek(fp, dstOff, SEEK_SET) < 0 ||
-			fwrite(buffer, 1, size, fp) < size;
-	}
-	return !rc;
+	return fseek(fp, offset, SEEK_SET) == 0;
+}
+
+/**
+ * Writes the header of a box record and starts entry->checksum from it. The
+ * data that follows has to be added to the checksum as it is written.
+ */
+static int write_box_header(FILE *fp, uint16_t boxIdx, struct boxg_box_entry *entry,
+	const struct boxg_boxmeta *meta, uint8_t encoding) {
+	struct boxg_box_header boxHeader = {0};
+
+	boxHeader.saveCounter = entry->saveCounter;
+	boxHeader.boxIdx = boxIdx;
+	boxHeader.encoding = encoding;
+	boxHeader.meta = *meta;
+	entry->checksum = crc32((const uint8_t*) &boxHeader, sizeof(boxHeader), 0);
+	sd_boxes_bytes_written += sizeof(boxHeader);
+	return seek_for_write(fp, BOX_RECORD_OFFSET(boxIdx, entry->copy)) &&
+		fwrite(&boxHeader, 1, sizeof(boxHeader), fp) == sizeof(boxHeader);
 }
 
-static int sd_boxes_create(uint8_t *boxData, uint8_t group, uint16_t numBoxes) {
+static int write_box_record(FILE *fp, const uint8_t *box, uint16_t boxIdx,
+	struct boxg_box_entry *entry, const struct boxg_boxmeta *meta) {
+	uint16_t packedSize = pack_box(pack_buffer, box);
+	const uint8_t *data = packedSize ? pack_buffer : box;
+
+	entry->dataSize = packedSize ? packedSize : 30 * PKMX_SIZE;
+	if (!write_box_header(fp, boxIdx, entry, meta,
+		packedSize ? BOX_ENCODING_PACKED : BOX_ENCODING_RAW))
+		return 0;
+	entry->checksum = crc32(data, entry->dataSize, entry->checksum);
+	sd_boxes_bytes_written += entry->dataSize;
+	return fwrite(data, 1, entry->dataSize, fp) == entry->dataSize;
+}
+
+static int write_directory(FILE *fp, uint32_t offset,
+	struct boxg_slot_header *slotHeader, const struct boxg_box_entry *entries) {
+	size_t entriesSize = slotHeader->numBoxes * sizeof(*entries);
+	slotHeader->checksum = directory_checksum(slotHeader, entries);
+	sd_boxes_bytes_written += sizeof(*slotHeader) + entriesSize;
+	return seek_for_write(fp, offset) &&
+		fwrite(slotHeader, 1, sizeof(*slotHeader), fp) == sizeof(*slotHeader) &&
+		fwrite(entries, 1, entriesSize, fp) == entriesSize;
+}
+
+/**
+ * Writes a new version 1 file. Without oldFp it has an empty directory, and
+ * boxes get added as they are saved. With oldFp, every box, its metadata,
+ * and the group name are copied over from that version 0 file.
+ */
+static int sd_boxes_create(const char *path, uint8_t group,
+	FILE *oldFp, const struct boxg_file_header *oldHeader) {
 	FILE *fp;
-	uint32_t slotSize;
-	struct boxg_file_header fileHeader = {0};
-	struct boxg_slot_header slotHeader = {0};
+	struct boxg_file_header fileHeader;
+	struct boxg_slot_header slotHeader;
+	struct boxg_box_entry *entries = work_entries;
+	struct boxg_slot_header oldSlotHeader = {0};
+	uint32_t oldSlotOffset = 0;
+	uint32_t oldDataOffset = 0;
+
+	if (oldFp) {
+		oldSlotOffset = oldHeader->activeSlot ? oldHeader->slot2Offset : sizeof(*oldHeader);
+		if (fseek(oldFp, oldSlotOffset, SEEK_SET) < 0 ||
+			fread(&oldSlotHeader, 1, sizeof(oldSlotHeader), oldFp) < sizeof(oldSlotHeader)) {
+			open_message_window("Error converting SD boxes: Unexpected EOF");
+			return 0;
+		}
+		if (oldSlotHeader.numBoxes > MAX_BOXES)
+			oldSlotHeader.numBoxes = MAX_BOXES;
+		oldDataOffset = oldSlotOffset + sizeof(oldSlotHeader) +
+			oldSlotHeader.numBoxes * sizeof(struct boxg_boxmeta);
+	}
 
 	// Create a new file
-	fp = fopen("/pokebox/boxes/group000.bin", "wb");
-	if (fp < 0) {
+	fp = sd_fopen(path, "w+b", SD_FILE_SEQUENTIAL);
+	if (!fp) {
 		open_message_window("Error saving SD boxes: File create failed (%d)", errno);
 		return 0;
 	}
 
 	// Write the file header
-	slotSize = sizeof(slotHeader) + numBoxes * (sizeof(struct boxg_boxmeta) + 30 * PKMX_SIZE);
 	memset(&fileHeader, 0, sizeof(fileHeader));
 	memcpy(&fileHeader.magic, BOXDATA_MAGIC, sizeof(fileHeader.magic));
+	fileHeader.version = BOXDATA_VERSION;
 	fileHeader.groupNumber = group;
-	fileHeader.slot2Offset = sizeof(fileHeader) + slotSize;
+	fileHeader.slot2Offset = SLOT2_OFFSET;
+	if (oldFp)
+		memcpy(fileHeader.groupName, oldHeader->groupName, sizeof(fileHeader.groupName));
 	fwrite(&fileHeader, 1, sizeof(fileHeader), fp);
 	if (ferror(fp))
 		goto create_write_error;
 
-	// Write the slot header
+	// Write the first copy of every box, then the directory that refers to them
 	memset(&slotHeader, 0, sizeof(slotHeader));
-	slotHeader.numBoxes = numBoxes;
-	fwrite(&slotHeader, 1, sizeof(slotHeader), fp);
-	if (ferror(fp))
-		goto create_write_error;
-
-	// Write the box metadata
-	for (int i = 0; i < numBoxes; i++) {
-		const struct boxg_boxmeta boxmeta = {0};
-		fwrite(&boxmeta, 1, sizeof(boxmeta), fp);
+	memset(entries, 0, sizeof(work_entries));
+	slotHeader.saveCounter = 1;
+	slotHeader.numBoxes = oldSlotHeader.numBoxes;
+	for (uint16_t boxIdx = 0; boxIdx < oldSlotHeader.numBoxes; boxIdx++) {
+		struct boxg_boxmeta boxmeta = {0};
+
+		fseek(oldFp, oldSlotOffset + sizeof(oldSlotHeader) + boxIdx * sizeof(boxmeta), SEEK_SET);
+		if (fread(&boxmeta, 1, sizeof(boxmeta), oldFp) < sizeof(boxmeta))
+			memset(&boxmeta, 0, sizeof(boxmeta));
+		entries[boxIdx].saveCounter = 1;
+		for (int pkmIdx = 0; pkmIdx < 30; pkmIdx++) {
+			fseek(oldFp, oldDataOffset + (boxIdx * 30 + pkmIdx) * PKMX_SIZE, SEEK_SET);
+			if (fgetc(oldFp) > 0)
+				entries[boxIdx].numPokemon++;
+		}
+		entries[boxIdx].dataSize = 30 * PKMX_SIZE;
+		sd_boxes_bytes_written += 30 * PKMX_SIZE;
+		if (!write_box_header(fp, boxIdx, &entries[boxIdx], &boxmeta, BOX_ENCODING_RAW) ||
+			!sd_file_copy(fp, BOX_RECORD_OFFSET(boxIdx, 0) + sizeof(struct boxg_box_header),
+				oldFp, oldDataOffset + boxIdx * 30 * PKMX_SIZE, 30 * PKMX_SIZE,
+				&entries[boxIdx].checksum))
+			goto create_write_error;
 	}
-	if (ferror(fp))
-		goto create_write_error;
-
-	// Write the box PKMX data
-	fwrite(boxData, 1, numBoxes * 30 * PKMX_SIZE, fp);
-	if (ferror(fp))
+	if (!write_directory(fp, sizeof(fileHeader), &slotHeader, entries))
 		goto create_write_error;
 
-	// Fill Slot 2 with zeroes
-	for (int i = 0; i < slotSize / 16; i++) {
-		const uint8_t zeroes[16] = {0};
-		fwrite(zeroes, 1, 16, fp);
-	}
 	fflush(fp);
 	if (ferror(fp))
 		goto create_write_error;
@@ -210,121 +494,418 @@ create_write_error:
 	return 0;
 }
 
-static int sd_boxes_update(uint8_t *boxData, uint16_t numBoxes, FILE *fp) {
-	size_t rc;
-	struct boxg_file_header fileHeader;
-	struct boxg_slot_header slotHeader;
-	uint16_t prevNumBoxes;
-	uint32_t nextSlotOffset, prevSlotOffset;
+/**
+ * Rewrites a version 0 file as version 1 in a new file, which then replaces
+ * the old one. If that gets interrupted after the old file is removed,
+ * open_group_file finishes the rename.
+ */
+static int sd_boxes_convert(void) {
+	char path[GROUP_PATH_SIZE];
+	char pathNew[GROUP_PATH_SIZE];
+	int rc;
 
-	// Verify existing file header
-	rc = fread(&fileHeader, 1, sizeof(fileHeader), fp) < sizeof(fileHeader) ||
-		memcmp(fileHeader.magic, BOXDATA_MAGIC, sizeof(fileHeader.magic));
-	if (rc) {
-		open_message_window("Error saving SD boxes: Invalid file type");
+	group_file_path(path, group_number, GROUP_EXT);
+	group_file_path(pathNew, group_number, GROUP_EXT_NEW);
+	// The old file is read from start to end, so give it the big buffer
+	group_fp = sd_freopen(path, "rb", group_fp, SD_FILE_SEQUENTIAL);
+	if (!group_fp) {
+		open_message_window("Error converting SD boxes: File open failed (%d)", errno);
 		return 0;
 	}
-	if (fileHeader.version != 0) {
-		open_message_window("Error saving SD boxes: Invalid file version");
+	rc = sd_boxes_create(pathNew, group_number, group_fp, &file_header);
+	fclose(group_fp);
+	group_fp = NULL;
+	if (!rc)
+		return 0;
+	if (remove(path) < 0 || rename(pathNew, path) < 0) {
+		open_message_window("Error converting SD boxes: Unable to replace old file (%d)", errno);
+		return 0;
+	}
+	group_fp = open_group_file(group_number, "r+b", SD_FILE_RANDOM);
+	if (!group_fp || !read_file_header(group_fp, &file_header)) {
+		open_message_window("Error converting SD boxes: File open failed (%d)", errno);
 		return 0;
 	}
+	return 1;
+}
 
-	// Read the previous save slot header
-	if (fileHeader.activeSlot) {
-		prevSlotOffset = fileHeader.slot2Offset;
-		nextSlotOffset = sizeof(fileHeader);
-		fseek(fp, prevSlotOffset, SEEK_SET);
-	} else {
-		prevSlotOffset = sizeof(fileHeader);
-		nextSlotOffset = fileHeader.slot2Offset;
+static int read_directories(void) {
+	// Fall back to the previous save if the latest directory is damaged
+	base_slot = file_header.activeSlot;
+	backup_valid = read_directory(group_fp, &file_header, !base_slot,
+		&dir_headers[!base_slot], dir_entries[!base_slot]);
+	if (!read_directory(group_fp, &file_header, base_slot,
+		&dir_headers[base_slot], dir_entries[base_slot])) {
+		if (!backup_valid)
+			return 0;
+		base_slot = !base_slot;
+		backup_valid = 0;
+		open_message_window("Some SD box data was damaged.\nOlder copies were loaded instead.");
 	}
-	fread(&slotHeader, 1, sizeof(slotHeader), fp);
-	fseek(fp, nextSlotOffset, SEEK_SET);
+	return 1;
+}
 
-	// Write the updated slot header
-	slotHeader.saveCounter++;
-	prevNumBoxes = slotHeader.numBoxes;
-	slotHeader.numBoxes = numBoxes >= prevNumBoxes ? numBoxes : prevNumBoxes;
-	fwrite(&slotHeader, 1, sizeof(slotHeader), fp);
-	if (ferror(fp))
-		goto update_write_error;
-
-	// Overwrite box metadata
-	copy_file_blocks(
-		nextSlotOffset + sizeof(slotHeader),
-		prevSlotOffset + sizeof(slotHeader),
-		numBoxes * sizeof(struct boxg_boxmeta),
-		fp);
-	if (ferror(fp))
-		goto update_write_error;
+int sd_boxes_create_dirs(void) {
+	struct stat s;
 
-	// Overwrite box data
-	fwrite(boxData, 1, numBoxes * 30 * PKMX_SIZE, fp);
-	if (ferror(fp))
-		goto update_write_error;
+	// Create the needed directories if they don't already exist
+	if (mkdir(SD_ROOT_DIR, 0777) < 0 && errno != EEXIST)
+		return 0;
+	if (mkdir(SD_BOXES_DIR, 0777) < 0) {
+		int createFail =
+			errno != EEXIST ||
+			stat(SD_BOXES_DIR, &s) < 0 ||
+			(s.st_mode & S_IFDIR) == 0;
+		if (createFail)
+			return 0;
+	}
+	return 1;
+}
 
-	// Copy trailing box data
-	if (prevNumBoxes > numBoxes) {
-		uint32_t tailOff = sizeof(slotHeader) +
-			numBoxes * 30 * PKMX_SIZE +
-			prevNumBoxes * sizeof(struct boxg_boxmeta);
-		copy_file_blocks(
-			nextSlotOffset + tailOff,
-			prevSlotOffset + tailOff,
-			(prevNumBoxes - numBoxes) * 30 * PKMX_SIZE,
-			fp);
+static void free_staged_entries(void) {
+	for (int boxIdx = 0; boxIdx < MAX_BOXES; boxIdx++) {
+		free(staged_entries[boxIdx]);
+		staged_entries[boxIdx] = NULL;
 	}
+	staged_entries_lost = 0;
+}
 
-	// Finalize the save
-	fileHeader.activeSlot = !fileHeader.activeSlot;
-	rewind(fp);
-	fwrite(&fileHeader, 1, sizeof(fileHeader), fp);
-	fclose(fp);
+static void stage_search_entries(const uint8_t *box, uint16_t boxIdx) {
+	if (!staged_entries[boxIdx])
+		staged_entries[boxIdx] = malloc(30 * sizeof(struct sd_search_entry));
+	if (!staged_entries[boxIdx]) {
+		staged_entries_lost = 1;
+		return;
+	}
+	for (int slot = 0; slot < 30; slot++)
+		sd_search_make_entry(&staged_entries[boxIdx][slot], box + slot * PKMX_SIZE);
+}
+
+/**
+ * Groups without a file only get one once something is written to them.
+ */
+static int ensure_group_file(void) {
+	char path[GROUP_PATH_SIZE];
 
+	if (group_fp)
+		return 1;
+	if (!sd_boxes_create_dirs()) {
+		open_message_window("Error saving SD boxes: Unable to create directories");
+		return 0;
+	}
+	group_file_path(path, group_number, GROUP_EXT);
+	if (!sd_boxes_create(path, group_number, NULL, NULL))
+		return 0;
+	group_fp = open_group_file(group_number, "r+b", SD_FILE_RANDOM);
+	if (!group_fp || !read_file_header(group_fp, &file_header) || !read_directories()) {
+		open_message_window("Error saving SD boxes: File open failed (%d)", errno);
+		sd_boxes_close();
+		return 0;
+	}
 	return 1;
+}
 
-update_write_error:
-	open_message_window("Error saving SD boxes: Write error (%d)", errno);
+/**
+ * Opens a box group for reading and writing individual boxes. Groups that
+ * don't have a file yet start out with 32 empty boxes.
+ */
+int sd_boxes_open(uint8_t group, uint16_t *numBoxes_out) {
+	struct sd_group_info info;
+
+	sd_boxes_close();
+	if (group >= SD_MAX_GROUPS) {
+		open_message_window("Error loading SD boxes: Invalid group %d", group);
+		return 0;
+	}
+	group_number = group;
+	memset(&file_header, 0, sizeof(file_header));
+	sd_boxes_bytes_written = 0;
+	memset(staged_boxes, 0, sizeof(staged_boxes));
+	memset(dir_headers, 0, sizeof(dir_headers));
+	memset(&work_header, 0, sizeof(work_header));
+	memset(work_entries, 0, sizeof(work_entries));
+	base_slot = 0;
+	backup_valid = 0;
+
+	group_fp = open_group_file(group, "r+b", SD_FILE_RANDOM);
+	if (!group_fp) {
+		if (errno != ENOENT) {
+			open_message_window("Error loading SD boxes: File open failed (%d)", errno);
+			return 0;
+		}
+		work_header.numBoxes = 32;
+		*numBoxes_out = work_header.numBoxes;
+		return 1;
+	}
+
+	// Read and validate the file header
+	if (!read_file_header(group_fp, &file_header)) {
+		open_message_window("Error loading SD boxes: Invalid file type");
+		sd_boxes_close();
+		return 0;
+	}
+	if (file_header.version == 0 && !sd_boxes_convert()) {
+		sd_boxes_close();
+		return 0;
+	}
+	if (file_header.version != BOXDATA_VERSION) {
+		open_message_window("Error loading SD boxes: Invalid file version");
+		sd_boxes_close();
+		return 0;
+	}
+
+	if (!read_directories()) {
+		open_message_window("Error loading SD boxes: Invalid box directory");
+		sd_boxes_close();
+		return 0;
+	}
+	work_header = dir_headers[base_slot];
+	memcpy(work_entries, dir_entries[base_slot],
+		work_header.numBoxes * sizeof(struct boxg_box_entry));
+	*numBoxes_out = work_header.numBoxes;
+
+	// Repair the index entry in case a save was interrupted before updating it
+	sd_boxes_group_info(&info);
+	sd_groups_update(&info);
+	return 1;
+}
+
+/**
+ * Reads one box, including any changes staged since the last commit. Boxes
+ * that were never written read as empty.
+ * Returns 0 on error, 1 on success, or 2 if the box was damaged and an older
+ * copy was read instead. That box should be written again.
+ */
+int sd_boxes_read_box(uint8_t *box, uint16_t boxIdx) {
+	const struct boxg_box_entry *entry = &work_entries[boxIdx];
+	uint8_t backupSlot = !base_slot;
+
+	if (!group_fp || boxIdx >= work_header.numBoxes || entry->saveCounter == 0) {
+		memset(box, 0, 30 * PKMX_SIZE);
+		return 1;
+	}
+	if (read_box_record(group_fp, box, boxIdx, entry))
+		return 1;
+
+	// The other directory may still point to an older, intact copy
+	if (backup_valid && boxIdx < dir_headers[backupSlot].numBoxes &&
+		dir_entries[backupSlot][boxIdx].saveCounter &&
+		read_box_record(group_fp, box, boxIdx, &dir_entries[backupSlot][boxIdx])) {
+		open_message_window("Some SD box data was damaged.\nOlder copies were loaded instead.");
+		return 2;
+	}
+
+	if (ferror(group_fp))
+		open_message_window("Error loading SD boxes: Read error (%d)", errno);
+	else
+		open_message_window("Error loading SD boxes: Box %d is corrupted", boxIdx + 1);
 	return 0;
 }
 
-int sd_boxes_save(uint8_t *boxData, uint8_t group, uint16_t numBoxes) {
-	FILE *fp;
-	size_t rc;
-	struct stat s;
+/**
+ * Stages a box to be saved by the next sd_boxes_commit. It goes into the copy
+ * that the committed directory doesn't use, so the last commit stays intact.
+ */
+int sd_boxes_write_box(const uint8_t *box, uint16_t boxIdx) {
+	struct boxg_box_entry *entry = &work_entries[boxIdx];
+	const struct boxg_box_entry *baseEntry = NULL;
+	struct boxg_boxmeta boxmeta = {0};
 
-	if (numBoxes <= 0 || numBoxes >= 256) {
-		open_message_window("Error saving SD boxes: Too many boxes in group");
+	if (boxIdx >= MAX_BOXES || !ensure_group_file())
 		return 0;
+
+	if (boxIdx < dir_headers[base_slot].numBoxes && dir_entries[base_slot][boxIdx].saveCounter)
+		baseEntry = &dir_entries[base_slot][boxIdx];
+
+	// Box metadata isn't edited yet, so carry it over from the committed copy
+	if (baseEntry) {
+		struct boxg_box_header boxHeader;
+		int rc = fseek(group_fp, BOX_RECORD_OFFSET(boxIdx, baseEntry->copy), SEEK_SET) == 0 &&
+			fread(&boxHeader, 1, sizeof(boxHeader), group_fp) == sizeof(boxHeader);
+		if (rc)
+			boxmeta = boxHeader.meta;
 	}
 
-	// Create the needed directories if they don't already exist
-	if (mkdir("/pokebox", 0777) < 0 && errno != EEXIST) {
-		open_message_window("Error saving SD boxes: Unable to create directories");
+	entry->copy = baseEntry ? !baseEntry->copy : 0;
+	entry->saveCounter = dir_headers[base_slot].saveCounter + 1;
+	entry->numPokemon = count_box_pokemon(box);
+	if (!write_box_record(group_fp, box, boxIdx, entry, &boxmeta)) {
+		open_message_window("Error saving SD boxes: Write error (%d)", errno);
 		return 0;
 	}
-	if (mkdir("/pokebox/boxes", 0777) < 0) {
-		int createFail =
-			errno != EEXIST ||
-			stat("/pokebox/boxes", &s) < 0 ||
-			(s.st_mode & S_IFDIR) == 0;
-		if (createFail) {
-			open_message_window("Error saving SD boxes: Unable to create directories");
-			return 0;
-		}
+	staged_boxes[boxIdx / 8] |= 1 << (boxIdx & 7);
+	stage_search_entries(box, boxIdx);
+	if (boxIdx >= work_header.numBoxes)
+		work_header.numBoxes = boxIdx + 1;
+	return 1;
+}
+
+/**
+ * Returns whether a box was written since the last commit.
+ */
+int sd_boxes_box_staged(uint16_t boxIdx) {
+	return boxIdx < MAX_BOXES && (staged_boxes[boxIdx / 8] & (1 << (boxIdx & 7)));
+}
+
+/**
+ * Rewrites the search entries of the boxes staged in the last commit. If the
+ * index didn't match oldSaveCounter it is left to be rebuilt by a search.
+ */
+static void update_search_index(uint32_t oldSaveCounter) {
+	if (staged_entries_lost || !sd_search_begin(group_number, oldSaveCounter))
+		return;
+	for (uint16_t boxIdx = 0; boxIdx < work_header.numBoxes; boxIdx++) {
+		if (staged_boxes[boxIdx / 8] & (1 << (boxIdx & 7)))
+			sd_search_write_entries(boxIdx, staged_entries[boxIdx]);
 	}
+	sd_search_finish(work_header.saveCounter, work_header.numBoxes);
+}
 
-	if (stat("/pokebox/boxes/group000.bin", &s) < 0) {
-		return sd_boxes_create(boxData, group, numBoxes);
+/**
+ * Makes every staged box part of the file, and grows the group to at least
+ * numBoxes boxes. Does nothing if nothing changed since the last commit.
+ */
+int sd_boxes_commit(uint16_t numBoxes) {
+	struct sd_group_info info;
+	uint8_t nextSlot;
+	int staged = 0;
+
+	if (numBoxes > MAX_BOXES) {
+		open_message_window("Error saving SD boxes: Too many boxes in group");
+		return 0;
 	}
+	if (numBoxes > work_header.numBoxes)
+		work_header.numBoxes = numBoxes;
+	for (int i = 0; i < sizeof(staged_boxes); i++)
+		staged |= staged_boxes[i];
+	if (!staged && group_fp && work_header.numBoxes == dir_headers[base_slot].numBoxes)
+		return 1;
+	if (!ensure_group_file())
+		return 0;
 
-	fp = fopen("/pokebox/boxes/group000.bin", "r+b");
-	if (fp < 0) {
-		open_message_window("Error saving SD boxes: File open failed (%d)", errno);
+	// The new directory goes in the other slot, after all the box data is written
+	nextSlot = !base_slot;
+	work_header.saveCounter = dir_headers[base_slot].saveCounter + 1;
+	if (fflush(group_fp) ||
+		!write_directory(group_fp, directory_offset(&file_header, nextSlot), &work_header, work_entries))
+		goto commit_write_error;
+
+	// Finalize the save
+	file_header.activeSlot = nextSlot;
+	if (fflush(group_fp) || fseek(group_fp, 0, SEEK_SET) < 0 ||
+		fwrite(&file_header, 1, sizeof(file_header), group_fp) < sizeof(file_header) ||
+		fflush(group_fp))
+		goto commit_write_error;
+	sd_boxes_bytes_written += sizeof(file_header);
+
+	dir_headers[nextSlot] = work_header;
+	memcpy(dir_entries[nextSlot], work_entries, sizeof(work_entries));
+	backup_valid = 1;
+	base_slot = nextSlot;
+	update_search_index(dir_headers[!nextSlot].saveCounter);
+	memset(staged_boxes, 0, sizeof(staged_boxes));
+	free_staged_entries();
+
+	sd_boxes_group_info(&info);
+	sd_groups_update(&info);
+	return 1;
+
+commit_write_error:
+	// Nothing staged is lost, so the commit can be retried
+	file_header.activeSlot = base_slot;
+	open_message_window("Error saving SD boxes: Write error (%d)", errno);
+	return 0;
+}
+
+/**
+ * Describes the open group as of the last commit. Groups that don't have a
+ * file yet report a save counter of 0.
+ */
+void sd_boxes_group_info(struct sd_group_info *info) {
+	if (group_fp) {
+		fill_group_info(info, group_number, &file_header,
+			&dir_headers[base_slot], dir_entries[base_slot]);
+	} else {
+		fill_group_info(info, group_number, NULL, &work_header, work_entries);
+	}
+}
+
+/**
+ * Describes any group from just its file header and directory, without
+ * touching the open group. Returns 0 if the group has no readable file.
+ */
+int sd_boxes_read_info(uint8_t group, struct sd_group_info *info) {
+	struct boxg_file_header fileHeader;
+	struct boxg_slot_header slotHeader;
+	FILE *fp;
+	int rc = 0;
+
+	fp = open_group_file(group, "rb", SD_FILE_RANDOM);
+	if (!fp)
+		return 0;
+	if (!read_file_header(fp, &fileHeader)) {
+		fclose(fp);
 		return 0;
 	}
 
-	rc = sd_boxes_update(boxData, numBoxes, fp);
+	if (fileHeader.version == 0) {
+		// Counting Pokemon would mean reading every box, so leave that for the conversion
+		rc = fseek(fp, directory_offset(&fileHeader, fileHeader.activeSlot), SEEK_SET) == 0 &&
+			fread(&slotHeader, 1, sizeof(slotHeader), fp) == sizeof(slotHeader);
+		if (rc) {
+			uint16_t numBoxes = MIN(slotHeader.numBoxes, MAX_BOXES);
+			slotHeader.numBoxes = 0;
+			fill_group_info(info, group, &fileHeader, &slotHeader, info_entries);
+			info->numBoxes = numBoxes;
+			info->numPokemon = SD_GROUP_UNKNOWN;
+		}
+	} else if (fileHeader.version == BOXDATA_VERSION) {
+		rc = read_directory(fp, &fileHeader, fileHeader.activeSlot, &slotHeader, info_entries) ||
+			read_directory(fp, &fileHeader, !fileHeader.activeSlot, &slotHeader, info_entries);
+		if (rc)
+			fill_group_info(info, group, &fileHeader, &slotHeader, info_entries);
+	}
 	fclose(fp);
 	return rc;
 }
+
+/**
+ * Passes every box of any group's last commit to func, without touching the
+ * open group. Boxes that were never written or can't be read are passed as
+ * NULL. Returns 0 if the group has no readable version 1 file.
+ */
+int sd_boxes_scan(uint8_t group, sd_boxes_scan_func func, void *arg,
+	uint32_t *saveCounter_out, uint16_t *numBoxes_out) {
+	struct boxg_file_header fileHeader;
+	struct boxg_slot_header slotHeader;
+	FILE *fp;
+	int rc;
+
+	fp = open_group_file(group, "rb", SD_FILE_SEQUENTIAL);
+	if (!fp)
+		return 0;
+	rc = read_file_header(fp, &fileHeader) && fileHeader.version == BOXDATA_VERSION &&
+		(read_directory(fp, &fileHeader, fileHeader.activeSlot, &slotHeader, info_entries) ||
+		read_directory(fp, &fileHeader, !fileHeader.activeSlot, &slotHeader, info_entries));
+	if (rc) {
+		for (uint16_t boxIdx = 0; boxIdx < slotHeader.numBoxes; boxIdx++) {
+			const struct boxg_box_entry *entry = &info_entries[boxIdx];
+			int valid = entry->saveCounter && read_box_record(fp, scan_box, boxIdx, entry);
+			func(boxIdx, valid ? scan_box : NULL, arg);
+		}
+		*saveCounter_out = slotHeader.saveCounter;
+		*numBoxes_out = slotHeader.numBoxes;
+	}
+	fclose(fp);
+	return rc;
+}
+
+/**
+ * Closes the group. Anything staged since the last commit is discarded.
+ */
+void sd_boxes_close(void) {
+	if (group_fp)
+		fclose(group_fp);
+	group_fp = NULL;
+	free_staged_entries();
+}
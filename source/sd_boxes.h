@@ -19,5 +19,21 @@
 
 #include <stdint.h>
 
-int sd_boxes_load(uint8_t *boxData, uint8_t group, uint8_t *numBoxes_out);
-int sd_boxes_save(uint8_t *boxData, uint8_t group, uint16_t numBoxes);
+#include "sd_groups.h"
+
+typedef void (*sd_boxes_scan_func)(uint16_t boxIdx, const uint8_t *box, void *arg);
+
+// Bytes written to the SD card since sd_boxes_open
+extern uint32_t sd_boxes_bytes_written;
+
+int sd_boxes_open(uint8_t group, uint16_t *numBoxes_out);
+int sd_boxes_read_box(uint8_t *box, uint16_t boxIdx);
+int sd_boxes_write_box(const uint8_t *box, uint16_t boxIdx);
+int sd_boxes_box_staged(uint16_t boxIdx);
+int sd_boxes_commit(uint16_t numBoxes);
+void sd_boxes_group_info(struct sd_group_info *info);
+int sd_boxes_read_info(uint8_t group, struct sd_group_info *info);
+int sd_boxes_scan(uint8_t group, sd_boxes_scan_func func, void *arg,
+	uint32_t *saveCounter_out, uint16_t *numBoxes_out);
+void sd_boxes_close(void);
+int sd_boxes_create_dirs(void);
@@ -0,0 +1,92 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "sd_file.h"
+
+#include <stdlib.h>
+
+#include "crc32.h"
+
+/* File helpers shared by everything that stores data on the SD card.
+ *
+ * libfat hands every read or write that isn't a whole sector to its sector
+ * cache, and stdio's default buffer only holds a couple of sectors, so many
+ * small transfers turn into repeated FAT lookups. Sequential files get a
+ * buffer that covers a whole cluster instead, and copies move data in
+ * buffer-sized chunks that line up with cluster boundaries.
+ */
+
+static void set_buffering(FILE *fp, enum SdFileAccess access) {
+	// A big buffer would make every scattered read fetch a whole cluster
+	size_t size = access == SD_FILE_SEQUENTIAL ? SD_FILE_BUFFER_SIZE : SD_SECTOR_SIZE;
+	// stdio allocates the buffer itself and frees it in fclose
+	setvbuf(fp, NULL, _IOFBF, size);
+}
+
+FILE* sd_fopen(const char *path, const char *mode, enum SdFileAccess access) {
+	FILE *fp = fopen(path, mode);
+	if (fp)
+		set_buffering(fp, access);
+	return fp;
+}
+
+FILE* sd_freopen(const char *path, const char *mode, FILE *fp, enum SdFileAccess access) {
+	fp = freopen(path, mode, fp);
+	if (fp)
+		set_buffering(fp, access);
+	return fp;
+}
+
+/**
+ * Copies size bytes between two files, which may be the same file as long as
+ * the ranges don't overlap. The first chunk is cut short so that every later
+ * write starts on a buffer-sized boundary in dst, which is also a sector and
+ * cluster boundary. If crc isn't NULL, the copied data is added to the CRC32
+ * it points to. Returns 0 on any read or write error.
+ */
+int sd_file_copy(FILE *dst, uint32_t dstOffset, FILE *src, uint32_t srcOffset, uint32_t size,
+	uint32_t *crc) {
+	uint8_t *buffer;
+	uint32_t bufferSize = SD_FILE_BUFFER_SIZE;
+	int success = 1;
+
+	// Work with less memory if needed, down to a single sector
+	while ((buffer = malloc(bufferSize)) == NULL) {
+		if (bufferSize == SD_SECTOR_SIZE)
+			return 0;
+		bufferSize /= 2;
+	}
+
+	while (size && success) {
+		uint32_t chunk = bufferSize - (dstOffset & (bufferSize - 1));
+		if (chunk > size)
+			chunk = size;
+		success =
+			fseek(src, srcOffset, SEEK_SET) == 0 &&
+			fread(buffer, 1, chunk, src) == chunk &&
+			fseek(dst, dstOffset, SEEK_SET) == 0 &&
+			fwrite(buffer, 1, chunk, dst) == chunk;
+		if (crc)
+			*crc = crc32(buffer, chunk, *crc);
+		srcOffset += chunk;
+		dstOffset += chunk;
+		size -= chunk;
+	}
+
+	free(buffer);
+	return success;
+}
@@ -0,0 +1,40 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SD_SECTOR_SIZE 512
+
+// Large enough to cover a whole cluster on most FAT32-formatted SD cards
+#ifndef SD_FILE_BUFFER_SIZE
+#define SD_FILE_BUFFER_SIZE (32 * 1024)
+#endif
+
+enum SdFileAccess {
+	// Small reads at scattered offsets, like looking up one icon
+	SD_FILE_RANDOM,
+	// Long runs of reads or writes, like dumping assets or saving boxes
+	SD_FILE_SEQUENTIAL
+};
+
+FILE* sd_fopen(const char *path, const char *mode, enum SdFileAccess access);
+FILE* sd_freopen(const char *path, const char *mode, FILE *fp, enum SdFileAccess access);
+int sd_file_copy(FILE *dst, uint32_t dstOffset, FILE *src, uint32_t srcOffset, uint32_t size,
+	uint32_t *crc);
@@ -0,0 +1,185 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "sd_groups.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "sd_boxes.h"
+#include "sd_file.h"
+
+#define GROUPS_MAGIC "PKMBGIDX"
+#define GROUPS_VERSION 1
+#define SD_GROUPS_FILE SD_BOXES_DIR "/groups.bin"
+
+/* The index file is a groups_file_header followed by one sd_group_info for
+ * each group that has a file, sorted by group number. It only duplicates
+ * what the group files already say, so the group list can be shown without
+ * opening every group. The group files stay authoritative: the index is
+ * rewritten whole after each commit, and an index that is missing or fails
+ * its checksum gets rebuilt by reading the directory of every group file.
+ */
+struct groups_file_header {
+	char magic[8]; // PKMBGIDX
+	uint16_t version;
+	uint16_t numGroups;
+	uint32_t checksum; // CRC32 of the group entries
+};
+
+static struct sd_group_info groups[SD_MAX_GROUPS];
+static uint16_t num_groups;
+static int groups_loaded = 0;
+
+static int write_index(void) {
+	struct groups_file_header header;
+	size_t size = num_groups * sizeof(*groups);
+	FILE *fp;
+	int rc;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GROUPS_MAGIC, sizeof(header.magic));
+	header.version = GROUPS_VERSION;
+	header.numGroups = num_groups;
+	header.checksum = crc32((const uint8_t*) groups, size, 0);
+
+	fp = sd_fopen(SD_GROUPS_FILE, "wb", SD_FILE_SEQUENTIAL);
+	if (!fp)
+		return 0;
+	rc = fwrite(&header, 1, sizeof(header), fp) == sizeof(header) &&
+		fwrite(groups, 1, size, fp) == size;
+	if (fclose(fp) != 0)
+		rc = 0;
+	return rc;
+}
+
+static int read_index(void) {
+	struct groups_file_header header;
+	FILE *fp;
+	int rc;
+
+	fp = sd_fopen(SD_GROUPS_FILE, "rb", SD_FILE_SEQUENTIAL);
+	if (!fp)
+		return 0;
+	rc = fread(&header, 1, sizeof(header), fp) == sizeof(header) &&
+		memcmp(header.magic, GROUPS_MAGIC, sizeof(header.magic)) == 0 &&
+		header.version == GROUPS_VERSION &&
+		header.numGroups <= SD_MAX_GROUPS &&
+		fread(groups, sizeof(*groups), header.numGroups, fp) == header.numGroups &&
+		crc32((const uint8_t*) groups, header.numGroups * sizeof(*groups), 0) == header.checksum;
+	fclose(fp);
+	num_groups = rc ? header.numGroups : 0;
+	return rc;
+}
+
+/**
+ * Returns the position of the group in the sorted list, or where it would
+ * be inserted if it isn't there.
+ */
+static uint16_t find_position(uint8_t group) {
+	uint16_t pos = 0;
+	while (pos < num_groups && groups[pos].groupNumber < group)
+		pos++;
+	return pos;
+}
+
+static void set_group(const struct sd_group_info *info) {
+	uint16_t pos = find_position(info->groupNumber);
+
+	if (pos >= num_groups || groups[pos].groupNumber != info->groupNumber) {
+		memmove(&groups[pos + 1], &groups[pos], (num_groups - pos) * sizeof(*groups));
+		num_groups++;
+	}
+	groups[pos] = *info;
+}
+
+/**
+ * Lists every group that has a file by reading the group directory, then
+ * writes a new index. Only needed when the index is missing or damaged.
+ */
+int sd_groups_rebuild(void) {
+	struct sd_group_info info;
+	struct dirent *pent;
+	DIR *pdir;
+
+	num_groups = 0;
+	groups_loaded = 1;
+	pdir = opendir(SD_BOXES_DIR);
+	if (!pdir)
+		return 0;
+	while ((pent = readdir(pdir)) != NULL) {
+		unsigned int group;
+		char name[16];
+
+		// Only groupNNN.bin, not the .new files of an interrupted conversion
+		if (sscanf(pent->d_name, "group%3u", &group) != 1 || group >= SD_MAX_GROUPS)
+			continue;
+		snprintf(name, sizeof(name), "group%03u.bin", group);
+		if (strcmp(pent->d_name, name) != 0)
+			continue;
+		if (sd_boxes_read_info(group, &info))
+			set_group(&info);
+	}
+	closedir(pdir);
+	return write_index();
+}
+
+static void load_groups(void) {
+	if (!groups_loaded && !read_index())
+		sd_groups_rebuild();
+	groups_loaded = 1;
+}
+
+/**
+ * Returns every group that has a file, sorted by group number. The list is
+ * read once and then kept up to date by sd_groups_update.
+ */
+const struct sd_group_info* sd_groups_list(uint16_t *numGroups_out) {
+	load_groups();
+	*numGroups_out = num_groups;
+	return groups;
+}
+
+/**
+ * Returns NULL if the group doesn't have a file yet.
+ */
+const struct sd_group_info* sd_groups_find(uint8_t group) {
+	uint16_t pos;
+
+	load_groups();
+	pos = find_position(group);
+	if (pos < num_groups && groups[pos].groupNumber == group)
+		return &groups[pos];
+	return NULL;
+}
+
+/**
+ * Records a group's new info, only writing the index if anything changed.
+ */
+int sd_groups_update(const struct sd_group_info *info) {
+	const struct sd_group_info *old;
+
+	if (info->groupNumber >= SD_MAX_GROUPS)
+		return 0;
+	old = sd_groups_find(info->groupNumber);
+	if (old && memcmp(old, info, sizeof(*info)) == 0)
+		return 1;
+	set_group(info);
+	return write_index();
+}
@@ -0,0 +1,46 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#ifndef SD_ROOT_DIR
+#define SD_ROOT_DIR "/pokebox"
+#endif
+#define SD_BOXES_DIR SD_ROOT_DIR "/boxes"
+
+// Group numbers from 0x40 up are used by the GUI for the cartridge
+#define SD_MAX_GROUPS 0x40
+
+// numPokemon of a version 0 group that hasn't been converted yet
+#define SD_GROUP_UNKNOWN 0xFFFF
+
+// Also the record format of the index file
+struct sd_group_info {
+	uint16_t name[16]; // UCS-2LE encoding
+	uint32_t saveCounter; // 0 if the group was never saved
+	uint16_t numBoxes;
+	uint16_t numPokemon;
+	uint8_t groupNumber;
+	uint8_t unused[3];
+};
+
+const struct sd_group_info* sd_groups_list(uint16_t *numGroups_out);
+const struct sd_group_info* sd_groups_find(uint8_t group);
+int sd_groups_update(const struct sd_group_info *info);
+int sd_groups_rebuild(void);
@@ -0,0 +1,324 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "sd_search.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pkmx_format.h"
+#include "sd_boxes.h"
+#include "sd_file.h"
+#include "sd_groups.h"
+
+#define SEARCH_MAGIC "PKMBSRCH"
+#define SEARCH_VERSION 2
+#define SEARCH_PATH_SIZE sizeof(SD_BOXES_DIR "/search000.bin")
+
+/* Each group with a file has a search index in SD_BOXES_DIR/searchNNN.bin,
+ * a search_file_header followed by an sd_search_entry for every slot of
+ * every box, box by box. The entries are made when a box is committed, so a
+ * search only has to read 16 bytes per slot instead of decoding each PKMX.
+ *
+ * The header says which save of the group the entries describe. The group
+ * file is committed first and the index after it, with its header written
+ * last, so an index whose save counter doesn't match the group's is stale
+ * and gets rebuilt from the group file before it's searched.
+ */
+struct search_file_header {
+	char magic[8]; // PKMBSRCH
+	uint16_t version;
+	uint8_t groupNumber;
+	uint8_t unused;
+	uint32_t saveCounter; // The save of the group that the entries describe
+	uint16_t numBoxes;
+	uint16_t unused2;
+};
+
+#define ENTRY_OFFSET(box, slot) \
+	(sizeof(struct search_file_header) + ((box) * 30 + (slot)) * sizeof(struct sd_search_entry))
+
+// The index being updated between sd_search_begin and sd_search_finish
+static FILE *update_fp = NULL;
+static uint8_t update_group;
+static uint16_t update_num_boxes; // How many boxes the file has entries for
+
+// Large enough for a few boxes per read while searching
+static struct sd_search_entry search_buffer[30 * 8];
+
+static void search_file_path(char *path, uint8_t group) {
+	snprintf(path, SEARCH_PATH_SIZE, SD_BOXES_DIR "/search%03u.bin", group);
+}
+
+static int read_search_header(FILE *fp, struct search_file_header *header) {
+	return fseek(fp, 0, SEEK_SET) == 0 &&
+		fread(header, 1, sizeof(*header), fp) == sizeof(*header) &&
+		memcmp(header->magic, SEARCH_MAGIC, sizeof(header->magic)) == 0 &&
+		header->version == SEARCH_VERSION;
+}
+
+static int write_search_header(FILE *fp, uint8_t group, uint32_t saveCounter, uint16_t numBoxes) {
+	struct search_file_header header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SEARCH_MAGIC, sizeof(header.magic));
+	header.version = SEARCH_VERSION;
+	header.groupNumber = group;
+	header.saveCounter = saveCounter;
+	header.numBoxes = numBoxes;
+	return fflush(fp) == 0 && fseek(fp, 0, SEEK_SET) == 0 &&
+		fwrite(&header, 1, sizeof(header), fp) == sizeof(header);
+}
+
+void sd_search_make_entry(struct sd_search_entry *entry, const uint8_t *pkmx) {
+	struct SimplePKM pkm;
+
+	memset(entry, 0, sizeof(*entry));
+	pkmx_to_simplepkm(&pkm, pkmx, 0);
+	if (!pkm.exists)
+		return;
+	entry->hash = pkm_fingerprint(pkmx, 0);
+	entry->trainerId = pkm.trainerId;
+	entry->species = pkm.dexNumber;
+	entry->heldItem = pkm.heldItem;
+	entry->form = pkm.form;
+	entry->level = pkm.level;
+	if (pkm.isShiny)
+		entry->flags |= SD_SEARCH_SHINY;
+	if (pkm.isEgg)
+		entry->flags |= SD_SEARCH_EGG;
+}
+
+static int write_entries(FILE *fp, uint16_t boxIdx, const struct sd_search_entry *entries) {
+	return fseek(fp, ENTRY_OFFSET(boxIdx, 0), SEEK_SET) == 0 &&
+		fwrite(entries, sizeof(*entries), 30, fp) == 30;
+}
+
+static int write_box_entries(FILE *fp, uint16_t boxIdx, const uint8_t *box) {
+	struct sd_search_entry entries[30];
+
+	for (int slot = 0; slot < 30; slot++) {
+		if (box)
+			sd_search_make_entry(&entries[slot], box + slot * PKMX_SIZE);
+		else
+			memset(&entries[slot], 0, sizeof(entries[slot]));
+	}
+	return write_entries(fp, boxIdx, entries);
+}
+
+/**
+ * Starts updating a group's index after a commit. Returns 0 if the index
+ * didn't describe saveCounter, the save before that commit; then there's
+ * nothing to update and a search will rebuild it instead.
+ */
+int sd_search_begin(uint8_t group, uint32_t saveCounter) {
+	struct search_file_header header;
+	char path[SEARCH_PATH_SIZE];
+
+	sd_search_abort();
+	search_file_path(path, group);
+	update_fp = sd_fopen(path, "r+b", SD_FILE_RANDOM);
+	if (!update_fp)
+		return 0;
+	if (!read_search_header(update_fp, &header) || header.saveCounter != saveCounter) {
+		sd_search_abort();
+		return 0;
+	}
+	update_group = group;
+	update_num_boxes = header.numBoxes;
+	return 1;
+}
+
+/**
+ * Extends the index with empty boxes up to numBoxes, because seeking past
+ * the end of the file to write isn't portable.
+ */
+static int grow_index(uint16_t numBoxes) {
+	for (; update_num_boxes < numBoxes; update_num_boxes++) {
+		if (!write_box_entries(update_fp, update_num_boxes, NULL))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Replaces the 30 entries of one box, which has to be called in box order.
+ * The entries come from sd_search_make_entry when the box was staged, so
+ * the box doesn't have to be read back.
+ */
+void sd_search_write_entries(uint16_t boxIdx, const struct sd_search_entry *entries) {
+	if (!update_fp)
+		return;
+	if (!grow_index(boxIdx) || !write_entries(update_fp, boxIdx, entries)) {
+		sd_search_abort();
+		return;
+	}
+	if (boxIdx >= update_num_boxes)
+		update_num_boxes = boxIdx + 1;
+}
+
+void sd_search_finish(uint32_t saveCounter, uint16_t numBoxes) {
+	if (!update_fp)
+		return;
+	if (grow_index(numBoxes))
+		write_search_header(update_fp, update_group, saveCounter, numBoxes);
+	fclose(update_fp);
+	update_fp = NULL;
+}
+
+/**
+ * Stops an update without marking the index as current, so it gets rebuilt.
+ */
+void sd_search_abort(void) {
+	if (update_fp)
+		fclose(update_fp);
+	update_fp = NULL;
+}
+
+static void rebuild_box(uint16_t boxIdx, const uint8_t *box, void *arg) {
+	FILE *fp = arg;
+	if (!ferror(fp))
+		write_box_entries(fp, boxIdx, box);
+}
+
+/**
+ * Makes a new index for a group by reading every box of its file.
+ */
+int sd_search_rebuild(uint8_t group) {
+	char path[SEARCH_PATH_SIZE];
+	uint32_t saveCounter = 0;
+	uint16_t numBoxes = 0;
+	FILE *fp;
+	int rc;
+
+	search_file_path(path, group);
+	fp = sd_fopen(path, "w+b", SD_FILE_SEQUENTIAL);
+	if (!fp)
+		return 0;
+	// The header only gets a save counter once every entry is written
+	rc = write_search_header(fp, group, 0, 0) &&
+		sd_boxes_scan(group, rebuild_box, fp, &saveCounter, &numBoxes) &&
+		!ferror(fp) &&
+		write_search_header(fp, group, saveCounter, numBoxes);
+	if (fclose(fp) != 0)
+		rc = 0;
+	if (!rc)
+		remove(path);
+	return rc;
+}
+
+static int entry_matches(const struct sd_search_entry *entry,
+	const struct sd_search_query *query) {
+	if (query->species && entry->species != query->species)
+		return 0;
+	if ((entry->flags & query->flags) != query->flags)
+		return 0;
+	return !query->matchTrainerId || entry->trainerId == query->trainerId;
+}
+
+/**
+ * Opens a group's index for searching, rebuilding it first if it's stale.
+ */
+static FILE* open_current_index(const struct sd_group_info *info,
+	struct search_file_header *header) {
+	char path[SEARCH_PATH_SIZE];
+	FILE *fp;
+
+	search_file_path(path, info->groupNumber);
+	fp = sd_fopen(path, "rb", SD_FILE_SEQUENTIAL);
+	if (fp && read_search_header(fp, header) && header->saveCounter == info->saveCounter)
+		return fp;
+	if (fp)
+		fclose(fp);
+	if (!sd_search_rebuild(info->groupNumber))
+		return NULL;
+	fp = sd_fopen(path, "rb", SD_FILE_SEQUENTIAL);
+	if (fp && read_search_header(fp, header))
+		return fp;
+	if (fp)
+		fclose(fp);
+	return NULL;
+}
+
+/**
+ * Passes every occupied slot of every group to func, in group, box and slot
+ * order. Groups whose index can't be read or rebuilt are skipped. Returns 0
+ * if func stopped the search.
+ */
+int sd_search_for_each(sd_search_func func, void *arg) {
+	const struct sd_group_info *groups;
+	struct sd_search_result result;
+	uint16_t numGroups;
+	int rc = 1;
+
+	groups = sd_groups_list(&numGroups);
+	for (uint16_t groupIdx = 0; groupIdx < numGroups && rc; groupIdx++) {
+		struct search_file_header header;
+		uint32_t numEntries, entryIdx = 0;
+		FILE *fp = open_current_index(&groups[groupIdx], &header);
+
+		if (!fp)
+			continue;
+		numEntries = header.numBoxes * 30;
+		while (entryIdx < numEntries && rc) {
+			size_t count = numEntries - entryIdx;
+			if (count > sizeof(search_buffer) / sizeof(*search_buffer))
+				count = sizeof(search_buffer) / sizeof(*search_buffer);
+			count = fread(search_buffer, sizeof(*search_buffer), count, fp);
+			if (count == 0)
+				break;
+			for (size_t i = 0; i < count && rc; i++, entryIdx++) {
+				if (search_buffer[i].species == 0)
+					continue;
+				result.entry = search_buffer[i];
+				result.group = header.groupNumber;
+				result.box = entryIdx / 30;
+				result.slot = entryIdx % 30;
+				rc = func(&result, arg);
+			}
+		}
+		fclose(fp);
+	}
+	return rc;
+}
+
+struct find_ctx {
+	const struct sd_search_query *query;
+	struct sd_search_result *results;
+	int maxResults;
+	int numResults;
+};
+
+static int find_func(const struct sd_search_result *result, void *arg) {
+	struct find_ctx *ctx = arg;
+	if (entry_matches(&result->entry, ctx->query))
+		ctx->results[ctx->numResults++] = *result;
+	return ctx->numResults < ctx->maxResults;
+}
+
+/**
+ * Looks through every group for Pokemon matching the query. Returns how many
+ * were stored in results, up to maxResults.
+ */
+int sd_search_find(const struct sd_search_query *query,
+	struct sd_search_result *results, int maxResults) {
+	struct find_ctx ctx = {query, results, maxResults, 0};
+
+	if (maxResults > 0)
+		sd_search_for_each(find_func, &ctx);
+	return ctx.numResults;
+}
@@ -0,0 +1,62 @@
+/*
+ * This file is part of the PokeBoxDS project.
+ * Copyright (C) 2020 Jennifer Berringer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; even with the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define SD_SEARCH_SHINY 0x01
+#define SD_SEARCH_EGG 0x02
+
+// What the search index knows about one box slot, without decrypting it
+struct sd_search_entry {
+	uint32_t hash; // pkm_fingerprint of the record
+	uint32_t trainerId; // Secret ID in the upper 16 bits
+	uint16_t species; // National Pokedex number, 0 for an empty slot
+	uint16_t heldItem;
+	uint8_t form;
+	uint8_t level;
+	uint8_t flags; // SD_SEARCH_*
+	uint8_t unused;
+};
+
+struct sd_search_query {
+	uint16_t species; // 0 matches any species
+	uint8_t flags; // Only entries with all of these flags match
+	uint8_t matchTrainerId;
+	uint32_t trainerId;
+};
+
+struct sd_search_result {
+	struct sd_search_entry entry;
+	uint8_t group;
+	uint8_t box;
+	uint8_t slot;
+};
+
+// Return 0 to stop
+typedef int (*sd_search_func)(const struct sd_search_result *result, void *arg);
+
+void sd_search_make_entry(struct sd_search_entry *entry, const uint8_t *pkmx);
+int sd_search_begin(uint8_t group, uint32_t saveCounter);
+void sd_search_write_entries(uint16_t boxIdx, const struct sd_search_entry *entries);
+void sd_search_finish(uint32_t saveCounter, uint16_t numBoxes);
+void sd_search_abort(void);
+int sd_search_rebuild(uint8_t group);
+int sd_search_for_each(sd_search_func func, void *arg);
+int sd_search_find(const struct sd_search_query *query,
+	struct sd_search_result *results, int maxResults);
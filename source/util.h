@@ -17,6 +17,8 @@
  */
 #pragma once
 
+#include <stdint.h>
+
 // General-purpose macros
 #define ARRAY_LENGTH(array) (sizeof((array))/sizeof((array)[0]))
 
@@ -30,9 +32,9 @@
 	_a < _b ? _a : _b; })
 
 // Shorter alternatives to uint*_t
-typedef unsigned char u8;
-typedef unsigned short u16;
-typedef unsigned long u32;
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
 
 // Utility functions for reading binary data
 #define GET16(arr, offset) (*((const u16*) ((u8*) (arr) + (offset))))